@@ -0,0 +1,48 @@
+#!/bin/sh
+# Time mysh builds against the benchmark workloads.
+#
+# Usage: bench/run.sh BINARY [BINARY...]
+#
+# Each workload is expanded to a larger script (the checked-in files are
+# templates that get repeated) and run ROUNDS times per binary; the best
+# wall time in milliseconds is reported.  Set BENCH_REPEAT / BENCH_ROUNDS
+# to change the workload size and BENCH_WORKLOADS to run a subset.
+
+REPEAT=${BENCH_REPEAT:-200}
+ROUNDS=${BENCH_ROUNDS:-3}
+WORKLOADS=${BENCH_WORKLOADS:-batch parse}
+DIR=$(dirname "$0")
+WORK=${TMPDIR:-/tmp}/mysh-bench.$$
+
+mkdir -p "$WORK" || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+for w in $WORKLOADS; do
+    i=0
+    : > "$WORK/$w.txt"
+    while [ $i -lt $REPEAT ]; do
+        cat "$DIR/$w.mysh" >> "$WORK/$w.txt"
+        i=$((i + 1))
+    done
+done
+
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+for bin in "$@"; do
+    for w in $WORKLOADS; do
+        best=
+        r=0
+        while [ $r -lt $ROUNDS ]; do
+            start=$(now_ms)
+            "$bin" "$WORK/$w.txt" > /dev/null 2>&1
+            elapsed=$(( $(now_ms) - start ))
+            if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+                best=$elapsed
+            fi
+            r=$((r + 1))
+        done
+        printf '%-16s %-6s %8d ms\n' "$bin" "$w" "$best"
+    done
+done
@@ -2,12 +2,20 @@
 #define MYSH_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mysh_plugin.h"
 
 #define MAX_TOKENS        1024
 #define MAX_COMMANDS      64
 #define MAX_ARGS          64
+#define MAX_CHAIN_JOBS    32
 #define INPUT_BUFFER_SIZE 4096
+#define BENCH_DEFAULT_RUNS   10
+#define BENCH_DEFAULT_WARMUP 1
 #define PROMPT "mysh> "
 
 /*
@@ -21,6 +29,20 @@ typedef enum {
     COND_OR
 } condition_t;
 
+/*
+ * Resource class of a job, used by the concurrent scheduler to cap how many
+ * jobs of one kind run at once (see mysh_sched.c). A job gets its class from
+ * a leading "@io" / "@cpu" / "@mem" annotation or from a command-name rule
+ * registered with the "jobclass" built-in.
+ */
+typedef enum {
+    JOB_CLASS_NONE = 0,
+    JOB_CLASS_IO,
+    JOB_CLASS_CPU,
+    JOB_CLASS_MEM,
+    JOB_CLASS_COUNT
+} job_class_t;
+
 /*
  * Representation of a single "job": either
  *   - a simple command, or
@@ -39,10 +61,37 @@ typedef struct {
 
     char *infile;      /* input redirection filename, or NULL */
     char *outfile;     /* output redirection filename, or NULL */
+    bool  atomic_out;  /* '>!': outfile replaced only if the job exits 0 */
 
     condition_t cond;  /* leading 'and' / 'or' token for this command */
+    job_class_t jclass; /* leading '@class' annotation, or JOB_CLASS_NONE */
+    char **inputs;     /* NULL-terminated '@in=PATH' declarations, or NULL */
+
+    size_t bench_runs;   /* 'bench' prefix: timed runs (0 = not a benchmark) */
+    size_t bench_warmup; /* 'bench' prefix: untimed warmup runs */
+    bool   perfstat;     /* 'perfstat' prefix: report perf counters per stage */
+
+    char **paths;      /* per-stage resolved program path, or NULL to look
+                          programs up at exec time (prepared jobs) */
 } job_t;
 
+/*
+ * A line of jobs joined by ";", "&&" and "||". Each job's cond holds the
+ * operator before it: COND_AND for "&&", COND_OR for "||", COND_NONE for
+ * ";". The first job keeps its leading "and" / "or", if any, which refers
+ * to the line before. Both kinds are checked against the status of the
+ * job that ran last, so a chain means the same as its jobs on separate
+ * lines; it differs in that the scheduler may run it as one unit.
+ *
+ * texts[i] is job i's part of the line as written; the pointers are into
+ * the line given to parse_chain().
+ */
+typedef struct {
+    job_t  *jobs;
+    char  **texts;
+    size_t  num_jobs;
+} chain_t;
+
 /*
  * Result of executing a job, from the shell's perspective.
  *
@@ -79,6 +128,212 @@ exec_action_t execute_job(const job_t *job,
                           bool input_is_tty,
                           int *cmd_status);
 
+/*
+ * Start every process of a job without waiting for any of them.
+ *
+ * pids must have room for job->num_procs entries; on success it holds the
+ * child PIDs in pipeline order (the last one decides the job's status).
+ * A run of adjacent native filter stages is fused into one coroutine with
+ * one pseudo pid, so there may be fewer pids than stages.
+ *
+ * Returns the number of pids on success, -1 if the job could not be
+ * started (children that were already forked have been reaped).
+ *
+ * Implemented in mysh_cmds.c.
+ */
+int launch_job(const job_t *job, bool input_is_tty, pid_t *pids);
+
+/*
+ * Start a chain as one process without waiting for it: a forked copy of
+ * the shell runs the jobs in order, checking each conditional against the
+ * previous job's status (status for the first job), and exits with the
+ * status of the last job that ran. None of the jobs may use a built-in.
+ *
+ * Returns 0 and sets *pid on success, -1 if the fork failed.
+ *
+ * Implemented in mysh_cmds.c.
+ */
+int launch_chain(const chain_t *chain, int status, bool input_is_tty, pid_t *pid);
+
+/*
+ * Shared-memory ring targets (mysh_shm.c): "> @shm:NAME" streams a job's
+ * stdout into the ring /dev/shm/mysh.NAME (created on first use), and
+ * "< @shm:NAME" reads one writer's output back until its EOF. Returns -1
+ * if path is not an "@shm:" target, -2 on error, else the job's end of a
+ * pipe that a detached pump process copies to / from the ring.
+ *
+ * Ring layout, for consumers: the header below at offset 0, the data at
+ * data_offset. head and tail count bytes ever written / consumed, so the
+ * unread bytes are [tail, head), at offsets (x & (capacity - 1)). The
+ * single producer stores head (release) after writing data and then bumps
+ * data_futex and FUTEX_WAKEs it; the single consumer stores tail (release)
+ * after reading and does the same with space_futex. eof is set once the
+ * current writer's job has finished and cleared when a new one attaches.
+ * Writers hold an flock() on the ring from clearing eof until setting it
+ * again, so there is only ever one producer; other producers should too.
+ */
+#define SHM_RING_MAGIC    "MYSHRING"
+#define SHM_RING_VERSION  1
+#define SHM_RING_CAPACITY (1u << 20)   /* data bytes; a power of two */
+
+typedef struct {
+    char     magic[8];      /* SHM_RING_MAGIC, not NUL-terminated */
+    uint32_t version;
+    uint32_t data_offset;
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t data_futex;
+    uint32_t space_futex;
+    uint32_t eof;
+} shm_ring_t;
+
+int open_shm_target(const char *path, bool for_output);
+
+/*
+ * Native pipeline generators (mysh_native.c): 'seq' with integer arguments
+ * and 'yes'. As the first stage of a foreground pipeline they run in the
+ * shell itself, which vmsplice()s their output into the first pipe instead
+ * of forking a process for them. is_native_generator() checks argv; a
+ * plugin builtin of the same name (here and for the filters below) takes
+ * precedence.
+ *
+ * run_native_stages() runs argvv[0] (a generator) fused with the native
+ * filters argvv[1, n): the generator's buffers go through the filters in
+ * the shell and only the result is written to fd. It returns when the
+ * generator is done, the filters want no more input or the reader exits,
+ * with the last stage's status (-1 if a stage isn't native).
+ */
+bool is_native_generator(char *const argv[]);
+int  run_native_stages(char **const argvv[], size_t n, int fd);
+
+/*
+ * ignore_sigpipe() ignores SIGPIPE, saving the old action, for code in the
+ * shell that writes to a pipe whose reader may be gone: the write then
+ * fails with EPIPE instead of killing the shell. restore_sigpipe() puts
+ * the saved action back.
+ */
+struct sigaction;
+void ignore_sigpipe(struct sigaction *saved);
+void restore_sigpipe(const struct sigaction *saved);
+
+/*
+ * Native filter stages (mysh_native.c): 'cat', 'wc [-lwc]' and
+ * 'head [-n N]' reading their stdin. A pipeline stage after the first runs
+ * as a coroutine inside the shell instead of a child process, and adjacent
+ * native stages share one: native_filter_start() runs the n filters
+ * argvv[0, n) as a single coroutine that hands each buffer from one filter
+ * to the next, with no pipe between them. It takes over in_fd and out_fd
+ * (own_out: out_fd is a pipe end only the shell holds, safe to make
+ * non-blocking) and returns the coroutine's pseudo pid, a negative number
+ * below -1. native_open_stdout() gives a last stage its fd for the shell's
+ * stdout: a private non-blocking description of a pipe (*own true), a
+ * plain dup of a regular file (*own false), or -1 for anything that could
+ * block the shell, such as a terminal; that stage then runs the real
+ * program.
+ *
+ * native_wait() is waitpid() for both kinds of pid. It runs the event loop
+ * that advances every coroutine while it waits, so any wait for a job that
+ * may involve coroutines must go through it. pid -1 returns the first
+ * child or coroutine to finish. native_wait_input() runs the loop until fd
+ * is readable, for the shell's own input. native_cancel() drops a
+ * coroutine that was never waited for. native_after_fork() is for a forked
+ * copy of the shell that keeps running shell code: it drops the parent's
+ * coroutines without touching their pipes' other ends.
+ */
+struct rusage;
+bool  is_native_filter(char *const argv[]);
+pid_t native_filter_start(char **const argvv[], size_t n, int in_fd, int out_fd,
+                          bool own_out);
+int   native_open_stdout(bool *own);
+pid_t native_wait(pid_t pid, int *wstatus, struct rusage *ru);
+void  native_wait_input(int fd);
+void  native_cancel(pid_t pid);
+void  native_after_fork(void);
+
+/*
+ * A pipeline stage on its own thread (mysh_native.c), waited for with
+ * native_wait() under a pseudo pid like a coroutine. native_thread_start()
+ * calls run(arg, in_fd, out_fd) on a new thread with every signal blocked
+ * and takes over both fds; the thread closes them as soon as run returns.
+ * native_cancel() cannot stop a thread; it is left to finish and then
+ * forgotten. Returns the pseudo pid, or -1.
+ */
+pid_t native_thread_start(int (*run)(void *arg, int in_fd, int out_fd), void *arg,
+                          int in_fd, int out_fd);
+
+/*
+ * Subreaper mode (mysh_reaper.c, --subreaper[=kill]). reaper_init() makes
+ * mysh the PR_SET_CHILD_SUBREAPER, so processes a job leaves behind are
+ * reparented to mysh. Each job gets an id from reaper_job_started(), and
+ * the processes it launches carry it in their environment (the child calls
+ * reaper_tag_child() before exec). reaper_job_finished() runs once all of
+ * the job's own processes are reaped. It picks up the job's orphans, kills
+ * them if kill_when_done is set, and reaps whatever has exited, adding
+ * the rusage to the job. A reaper that waits for any child passes pids it
+ * doesn't know to reaper_adopted_exit(). reaper_report() prints the
+ * per-job totals. All of these are no-ops unless reaper_init() succeeded.
+ * reaper_after_fork() turns them off in a forked copy of the shell.
+ */
+int      reaper_init(bool kill_when_done);
+bool     reaper_enabled(void);
+unsigned reaper_job_started(const job_t *job);
+unsigned reaper_current_job(void);
+void     reaper_tag_child(void);
+void     reaper_after_fork(void);
+void     reaper_job_finished(unsigned job);
+void     reaper_adopted_exit(pid_t pid, const struct rusage *ru);
+void     reaper_report(FILE *out);
+
+/*
+ * True if pid is a running coprocess. Whoever else waits for one (the -j
+ * scheduler's waitpid(-1)) hands its status to coproc_reaped(), which
+ * keeps it for "coproc NAME". Implemented in mysh_cmds.c.
+ */
+bool is_coproc_pid(pid_t pid);
+void coproc_reaped(pid_t pid, int wstatus);
+
+/*
+ * Whoever reaps the last process of a launched job must pass its wait
+ * status here: for a '>!' job this links the output into place (exit 0)
+ * or discards it. Other pids are ignored. Implemented in mysh_cmds.c.
+ */
+void finish_atomic_output(pid_t pid, int wstatus);
+
+/*
+ * For a forked copy of the shell that keeps running shell code: forget the
+ * parent's coprocesses and pending '>!' outputs (closing only our copies
+ * of their fds). Implemented in mysh_cmds.c.
+ */
+void cmds_after_fork(void);
+
+/*
+ * Nonzero if name is a shell built-in, including those registered by
+ * plugins. Implemented in mysh_cmds.c.
+ */
+int is_builtin(const char *name);
+
+/*
+ * Find the program a command name runs: names containing '/' are used as
+ * is, built-ins are never searched, anything else is looked up in
+ * /usr/local/bin, /usr/bin, /bin. Returns a malloc'd path or NULL.
+ * Implemented in mysh_cmds.c.
+ */
+char *resolve_program_path(const char *cmd_name);
+
+/*
+ * Nested scripts. A forked child about to exec path with argv checks
+ * is_nested_script() (mysh_cmds.c): true for an executable mysh script,
+ * i.e. a "#!.../mysh" or "#!.../env mysh" line or a *.mysh name without
+ * "#!", run with no arguments. The child then calls run_nested_script()
+ * (mysh_core.c) instead of exec: it drops the parent's concurrent jobs,
+ * coroutines, coprocesses and subreaper role, runs the script as
+ * "mysh path" would, and returns the exit status for _exit(). The intern
+ * table, plugins and the rest of the warm heap carry over.
+ */
+bool is_nested_script(const char *path, char *const argv[]);
+int  run_nested_script(const char *path);
+
 /*
  * Free all dynamic memory associated with a job.
  *
@@ -90,6 +345,68 @@ exec_action_t execute_job(const job_t *job,
  */
 void free_job(job_t *job);
 
+/* Print "mysh: context: message" to stderr. Implemented in mysh_core.c. */
+void print_mysh_error(const char *context, const char *message);
+
+/*
+ * Token interning (mysh_intern.c). The tokenizer passes every token
+ * through intern(), which returns the one shared copy of it, so a parsed
+ * job's argv, redirections and '@in=' paths point into the intern table
+ * instead of owning copies. Interned strings live as long as the shell;
+ * free_job() releases strings with intern_free(), which only frees the
+ * ordinary heap copies intern() returns once the table is full (or NULL on
+ * allocation failure).
+ *
+ * The shell's own words are interned up front: is_word() is a pointer
+ * compare for interned tokens and falls back to strcmp() for any other
+ * string (argv built by hand, prepared-job values).
+ */
+typedef enum {
+    WORD_AND,
+    WORD_OR,
+    WORD_BENCH,
+    WORD_PERFSTAT,
+    WORD_PIPE,
+    WORD_IN,
+    WORD_OUT,
+    WORD_OUT_ATOMIC,
+    WORD_CD,          /* built-in names: WORD_CD .. WORD_WAITFOR */
+    WORD_PWD,
+    WORD_WHICH,
+    WORD_EXIT,
+    WORD_DIE,
+    WORD_JOBCLASS,
+    WORD_COPROC,
+    WORD_WAITFOR,
+    NUM_WORDS
+} word_t;
+
+char       *intern(const char *s);
+void        intern_free(char *s);
+bool        is_interned(const char *s);
+const char *intern_word(word_t w);
+bool        is_word(const char *s, word_t w);
+
+/*
+ * Builtin plugins (mysh_plugin.c; the ABI is mysh_plugin.h).
+ * plugin_load_dir() dlopen()s every *.so in dir and runs its
+ * mysh_plugin_init(); it returns how many plugins loaded, or -1 if dir
+ * can't be read. plugin_register() is the register_builtin() plugins get,
+ * also usable by a program embedding the shell.
+ *
+ * plugin_flags() is a registered builtin's MYSH_BUILTIN_* flags, 0 if
+ * name isn't one. plugin_run() runs it in the calling process (the shell
+ * or a child) on the given fds, with SIGPIPE ignored, and returns its
+ * status. plugin_thread_start() runs it as a pipeline stage on its own
+ * thread (see native_thread_start()), taking over both fds; it returns the
+ * stage's pseudo pid, or -1.
+ */
+int      plugin_load_dir(const char *dir);
+int      plugin_register(const mysh_builtin_def_t *def);
+unsigned plugin_flags(const char *name);
+int      plugin_run(char *const argv[], int in_fd, int out_fd, int err_fd);
+pid_t    plugin_thread_start(char *const argv[], int in_fd, int out_fd);
+
 /*
  * Parse a single input line into a job_t.
  *
@@ -100,4 +417,285 @@ void free_job(job_t *job);
  */
 int parse_line(char *line, job_t *job);
 
+/*
+ * Parse a line that may hold several jobs joined by ";", "&&" and "||"
+ * (see chain_t). A trailing ";" is allowed. Same return values as
+ * parse_line(); on error the chain is left empty.
+ */
+int  parse_chain(char *line, chain_t *chain);
+void free_chain(chain_t *chain);
+
+/*
+ * Run (or skip, per its conditional) a job returned by parse_line(), with
+ * parse_status being parse_line()'s return value. Tracks the status used by
+ * later conditionals. The caller keeps ownership of the job.
+ *
+ * If cond_status is non-NULL and the job has a conditional, it receives the
+ * status that conditional was checked against.
+ *
+ * Returns -1 to keep going, or the shell's exit code after exit / die.
+ *
+ * Implemented in mysh_core.c, along with:
+ *   resume_with_status()  - make the next conditional see status
+ *   finish_pending_jobs() - wait for concurrent jobs, return last status
+ */
+int  run_parsed_job(job_t *job, int parse_status, int *cond_status);
+void resume_with_status(int status);
+int  finish_pending_jobs(void);
+
+/*
+ * Prepared job templates (mysh_prepared.c), for daemons and embedders that
+ * run the same job many times with different arguments.
+ *
+ * prepare_job() tokenizes and parses a line once and resolves every stage's
+ * program path. Arguments and redirection targets written as "$1", "$2", ...
+ * are placeholders. execute_prepared() binds values[0] to "$1" and so on
+ * and runs the job through execute_job() with no tokenizing, parsing or
+ * path search. Conditionals are not allowed in a template.
+ *
+ * A template reuses its own argv storage on every call, so one template must
+ * not be executed from two threads at once.
+ */
+typedef struct job_template job_template_t;
+
+job_template_t *prepare_job(const char *line);
+exec_action_t   execute_prepared(job_template_t *tmpl,
+                                 char *const values[], size_t num_values,
+                                 bool input_is_tty, int *cmd_status);
+void            free_prepared(job_template_t *tmpl);
+
+/*
+ * Watch mode (mysh_watch.c): run the script, then use inotify on every
+ * job's infile and '@in=' inputs and on the script itself. On a change,
+ * re-run only the affected jobs, their and/or chains and jobs reading what
+ * those write; a changed script is reloaded and run in full. Does not
+ * return unless watching fails.
+ *
+ * watch_affected() is the selection step on its own: it loads script,
+ * marks the jobs a change to file affects, sets affected[i] for job i (a
+ * chain's jobs count one by one) for up to max jobs, and unloads it again.
+ * Returns how many jobs were selected, or -1 if the script can't be read.
+ */
+int watch_script(const char *path);
+int watch_affected(const char *script, const char *file, bool *affected, size_t max);
+
+/*
+ * Read/execute loop (mysh_core.c): run every line read from fd, then wait
+ * for any jobs still in flight. Returns the shell's exit status.
+ */
+int read_and_execute_loop(int fd);
+
+/*
+ * Flight recorder (mysh_flight.c).
+ *
+ * An always-on ring of the last FLIGHT_CAPACITY events, each a fixed-size
+ * binary record. flight_record() costs a clock read, a getpid() and a few
+ * relaxed stores. The ring is dumped to $MYSH_FLIGHT_DIR/mysh-flight.PID
+ * (default /tmp) on SIGUSR1, on 'die' and on a fatal signal; the dump is a
+ * flight_header_t followed by the raw ring, decoded by tools/flightdump.
+ *
+ * A record's seq is 1 + its event number, so seq 0 is an unused slot (or,
+ * in a dump, one that was being written) and the oldest surviving event is
+ * the one with the smallest seq.
+ */
+#define FLIGHT_MAGIC    "MYSHFLT1"
+#define FLIGHT_CAPACITY 4096     /* records; must be a power of two */
+
+typedef enum {
+    FLIGHT_PARSE = 1,   /* a = parse status, b = number of stages */
+    FLIGHT_SPAWN,       /* a = child pid,    b = pipeline stage */
+    FLIGHT_REAP,        /* a = child pid,    b = raw wait status */
+    FLIGHT_REDIRECT,    /* a = fd or -errno, b = 0 for '<', 1 for '>' */
+    FLIGHT_COND_SKIP,   /* a = condition_t,  b = status it was checked against */
+    FLIGHT_DIE,         /* a = shell exit status */
+    FLIGHT_SIGNAL,      /* a = signal number, b = 1 if fatal */
+} flight_event_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ns;        /* CLOCK_MONOTONIC */
+    int32_t  pid;       /* process that recorded the event */
+    uint16_t event;     /* flight_event_t */
+    uint16_t reserved;
+    int32_t  a;
+    int32_t  b;
+} flight_rec_t;
+
+typedef struct {
+    char     magic[8];  /* FLIGHT_MAGIC, not NUL-terminated */
+    uint32_t capacity;
+    uint32_t rec_size;
+    uint64_t next;      /* events recorded so far */
+    int32_t  pid;       /* process that wrote the dump */
+    uint32_t reserved;
+} flight_header_t;
+
+int  flight_init(void);
+void flight_record(flight_event_t event, int32_t a, int32_t b);
+int  flight_dump_fd(int fd);
+void flight_dump(void);
+
+/*
+ * Dependency analysis (mysh_analyze.c).
+ *
+ * Jobs are added in script order and linked to the earlier jobs they must
+ * follow: the job before an and/or, the last shell-state built-in (cd,
+ * exit, die, jobclass, coproc), and any job whose '<' / '>' / '@in=' files
+ * overlap with theirs in a read/write or write/write way.
+ *
+ * analyze_critical_path() returns the longest weighted path and stores the
+ * sum of all weights in *total_work; their ratio is the speedup unlimited
+ * -j could reach. analyze_report() prints the graph, the critical path and
+ * that ratio; weights are seconds when measured, else one per job.
+ *
+ * --report records every job run by the read loop with its duration
+ * (analyze_job_started / analyze_job_finished); --analyze parses a script
+ * without running it (analyze_script).
+ */
+void   analyze_set_recording(bool on);
+bool   analyze_recording(void);
+int    analyze_add_job(const job_t *job, const char *text, double weight);
+void   analyze_job_started(void);
+void   analyze_job_finished(const job_t *job, const char *text);
+double analyze_critical_path(double *total_work);
+void   analyze_report(FILE *out, bool measured);
+void   analyze_reset(void);
+int    analyze_script(const char *path);
+
+/*
+ * Progress reporting for batch runs (mysh_progress.c, --progress[=FD]).
+ *
+ * progress_init() starts reporting to fd on the script being read from
+ * input_fd; script is its path, for the history kept in SCRIPT.progress,
+ * or NULL. The read loop then reports each line it consumed with
+ * progress_line() and each job it parsed with progress_jobs(); about once
+ * a second that writes a line with the share of the script read, jobs per
+ * second, the time so far and an ETA. progress_end() writes the final
+ * line, and when complete (the script was read to the end) saves the
+ * history the next run's ETA is based on. progress_eta() is the number of
+ * seconds left, or -1 if it cannot be estimated. progress_after_fork()
+ * turns reporting off in a forked copy of the shell. All of these are
+ * no-ops unless progress_init() was called.
+ */
+int    progress_init(int fd, int input_fd, const char *script);
+void   progress_line(size_t bytes);
+void   progress_jobs(size_t n);
+double progress_eta(double elapsed, bool *from_history);
+void   progress_end(bool complete);
+void   progress_after_fork(void);
+
+/*
+ * Spool mode (mysh_spool.c): consume "*.job" files dropped into dir, up to
+ * max_jobs at a time. Each file is claimed by renaming it into dir/claimed/
+ * (so consumers sharing dir never run the same file twice) and run as a
+ * script in a forked shell; its stdout, stderr and exit status end up in
+ * dir/done/NAME.out, NAME.err and NAME.status. Does not return unless
+ * setting up the directory fails.
+ */
+int spool_consume(const char *dir, size_t max_jobs);
+
+/*
+ * The steps spool_consume() is made of. spool_prepare() makes dir/claimed/
+ * and dir/done/ and uses dir from then on. spool_is_job_name() says if a
+ * file name is a job file. spool_claim() renames a job file into claimed/:
+ * 0 if this consumer got it, -1 if another one did first (or it failed).
+ * spool_finish() writes done/NAME.status and moves the job file to done/.
+ */
+int  spool_prepare(const char *dir);
+bool spool_is_job_name(const char *name);
+int  spool_claim(const char *name);
+void spool_finish(const char *name, int status);
+
+/*
+ * Concurrent job scheduler (mysh_sched.c).
+ *
+ * With "-j N" the core loop hands jobs that contain no built-ins to the
+ * scheduler instead of running them in the foreground. Up to N jobs are in
+ * flight at once, further limited per resource class. A job's status is only
+ * collected when something needs it: a following and/or job, a redirection
+ * that touches a file an in-flight job reads or writes, or the end of input.
+ */
+
+/* Enable concurrent execution with at most max_jobs jobs in flight (>= 2). */
+int  sched_init(size_t max_jobs);
+
+/*
+ * In a forked copy of the shell: forget the parent's in-flight jobs, held
+ * output and class rules, and go back to serial execution.
+ */
+void sched_after_fork(void);
+
+/* True if sched_init() enabled concurrent execution. */
+bool sched_enabled(void);
+
+/*
+ * Adaptive mode: treat max_jobs as a ceiling and move the number of jobs
+ * allowed in flight between 1 and that ceiling, following CPU / memory / IO
+ * pressure stall information (/proc/pressure) and the load average. Only
+ * new launches are throttled; running jobs are never stopped.
+ */
+void sched_set_adaptive(bool on);
+
+/* Number of jobs currently allowed in flight. */
+size_t sched_current_limit(void);
+
+/*
+ * Move the limit one step for a pressure sample: the highest PSI "some
+ * avg10" percentage and the 1-minute load per CPU (-1 if unavailable).
+ * Adaptive mode feeds it from /proc at most once a second.
+ */
+void sched_adapt_sample(double psi, double load);
+
+/*
+ * Ordered output: each concurrent job's stdout and stderr go to memfd spools
+ * that are copied to the real stdout / stderr in script order, as soon as
+ * every earlier job has finished, so output reads like a serial run.
+ * Returns -1 if the real stdout / stderr could not be saved.
+ */
+int  sched_set_ordered(bool on);
+
+/*
+ * Called before a job runs in the foreground. In ordered mode, waits for
+ * every in-flight job so their output is written before the foreground
+ * job's; otherwise does nothing.
+ */
+void sched_flush_output(void);
+
+/* True if job may run asynchronously (no built-in in any stage). */
+bool sched_can_defer(const job_t *job);
+
+/*
+ * Wait for in-flight jobs whose files conflict with job's (read-after-write,
+ * write-after-read, write-after-write on the same file). A job reads its
+ * '<' file and its '@in=' inputs and writes its '>' file.
+ * Paths are compared in canonical form, so "x" and "./x" are one file.
+ */
+void sched_wait_conflicts(const job_t *job);
+
+/*
+ * Start job asynchronously, first waiting for a free slot in its class.
+ * Returns 0 if the job was started, -1 if it could not be.
+ */
+int  sched_submit(const job_t *job, bool input_is_tty);
+
+/*
+ * Start a whole chain asynchronously as one job (see launch_chain()),
+ * first waiting for a free slot. The chain's class is that of its first
+ * classified job. Returns 0 if it was started, -1 if it could not be.
+ */
+bool sched_can_defer_chain(const chain_t *chain);
+int  sched_submit_chain(const chain_t *chain, int status, bool input_is_tty);
+
+/* Wait for the most recently submitted job; returns its exit status. */
+int  sched_wait_last(void);
+
+/* Wait for every in-flight job; returns the last submitted job's status. */
+int  sched_drain(void);
+
+/* Resource-class configuration, used by the "jobclass" built-in. */
+int  sched_class_from_name(const char *name, job_class_t *out);
+void sched_set_class_limit(job_class_t jclass, size_t limit);
+int  sched_add_class_rule(job_class_t jclass, const char *cmd_name);
+job_class_t sched_class_of(const job_t *job);
+
 #endif
@@ -0,0 +1,371 @@
+// Dependency analysis for mysh scripts (--analyze, --report).
+//
+// This file is responsible for:
+//   - Recording each job of a script as a node of a dependency graph
+//   - Deriving the graph's edges from and/or chains, shell-state built-ins
+//     and redirection file overlap
+//   - Reporting per-job durations, the critical path, total work and the
+//     theoretical speedup of running the script with unlimited -j
+//
+// The edges follow what the -j scheduler itself has to respect:
+//   - an "and" / "or" job, or one after "&&" / "||", depends on the job
+//     right before it;
+//   - a built-in that changes shell state (cd, exit, die, jobclass, coproc)
+//     is a barrier: it depends on every earlier job and every later job
+//     depends on it;
+//   - a job depends on an earlier one if either writes a file the other
+//     reads or writes ('<', '>', '@in=').
+// Nodes only ever depend on earlier nodes, so script order is already a
+// topological order.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+typedef struct {
+    char   *text;      // the line, for the report
+    char  **reads;     // NULL-terminated: infile and '@in=' files
+    char   *writes;    // outfile, or NULL
+    bool    barrier;
+    bool    cond;
+    double  weight;    // seconds, or 1 per job for static analysis
+    size_t *deps;
+    size_t  num_deps;
+    double  finish;    // earliest finish with unlimited parallelism
+    size_t  via;       // predecessor on the longest path, or SIZE_MAX
+} analyze_node_t;
+
+static analyze_node_t *nodes;
+static size_t num_nodes;
+static size_t cap_nodes;
+static bool   recording;
+static struct timespec job_start;
+
+static const word_t state_builtins[] = {
+    WORD_CD, WORD_EXIT, WORD_DIE, WORD_JOBCLASS, WORD_COPROC,
+};
+
+static bool
+is_state_builtin(const job_t *job)
+{
+    size_t n = sizeof(state_builtins) / sizeof(state_builtins[0]);
+    for (size_t i = 0; i < job->num_procs; i++) {
+        for (size_t b = 0; b < n; b++) {
+            if (is_word(job->argvv[i][0], state_builtins[b])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static char *
+analyze_strdup(const char *s)
+{
+    if (s == NULL) {
+        return NULL;
+    }
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+static bool
+node_reads(const analyze_node_t *node, const char *path)
+{
+    for (size_t i = 0; path != NULL && node->reads[i] != NULL; i++) {
+        if (strcmp(node->reads[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+files_overlap(const analyze_node_t *earlier, const analyze_node_t *later)
+{
+    if (earlier->writes != NULL &&
+        (node_reads(later, earlier->writes) ||
+         (later->writes != NULL && strcmp(later->writes, earlier->writes) == 0))) {
+        return true;  // read after write, write after write
+    }
+    return node_reads(earlier, later->writes);  // write after read
+}
+
+static int
+add_dep(analyze_node_t *node, size_t dep)
+{
+    if (node->num_deps > 0 && node->deps[node->num_deps - 1] == dep) {
+        return 0;
+    }
+    size_t *grown = realloc(node->deps, (node->num_deps + 1) * sizeof(size_t));
+    if (grown == NULL) {
+        return -1;
+    }
+    node->deps = grown;
+    node->deps[node->num_deps++] = dep;
+    return 0;
+}
+
+// Fill in the edges of the newest node.
+static int
+link_node(size_t idx)
+{
+    analyze_node_t *node = &nodes[idx];
+
+    // The most recent barrier (if any) orders everything before it.
+    size_t first = 0;
+    for (size_t j = idx; j-- > 0;) {
+        if (nodes[j].barrier) {
+            first = j;
+            break;
+        }
+    }
+
+    for (size_t j = first; j < idx; j++) {
+        bool dep = node->barrier ||
+                   (j == first && nodes[j].barrier) ||
+                   (node->cond && j == idx - 1) ||
+                   files_overlap(&nodes[j], node);
+        if (dep && add_dep(node, j) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+analyze_set_recording(bool on)
+{
+    recording = on;
+}
+
+bool
+analyze_recording(void)
+{
+    return recording;
+}
+
+static void
+free_node(analyze_node_t *node)
+{
+    for (size_t k = 0; node->reads && node->reads[k] != NULL; k++) {
+        free(node->reads[k]);
+    }
+    free(node->reads);
+    free(node->text);
+    free(node->writes);
+    free(node->deps);
+}
+
+int
+analyze_add_job(const job_t *job, const char *text, double weight)
+{
+    if (num_nodes == cap_nodes) {
+        size_t cap = cap_nodes ? cap_nodes * 2 : 64;
+        analyze_node_t *grown = realloc(nodes, cap * sizeof(*nodes));
+        if (grown == NULL) {
+            return -1;
+        }
+        nodes = grown;
+        cap_nodes = cap;
+    }
+
+    size_t num_reads = (job->infile != NULL) ? 1 : 0;
+    for (size_t i = 0; job->inputs && job->inputs[i] != NULL; i++) {
+        num_reads++;
+    }
+
+    analyze_node_t *node = &nodes[num_nodes];
+    memset(node, 0, sizeof(*node));
+    node->text    = analyze_strdup(text);
+    node->reads   = calloc(num_reads + 1, sizeof(char *));
+    node->writes  = analyze_strdup(job->outfile);
+    node->barrier = is_state_builtin(job);
+    node->cond    = job->cond != COND_NONE;
+    node->weight  = weight;
+    node->via     = SIZE_MAX;
+    if (node->text == NULL || node->reads == NULL ||
+        (job->outfile != NULL && node->writes == NULL)) {
+        free_node(node);  // not counted yet, so analyze_reset() won't
+        return -1;
+    }
+
+    // reads stays NULL-terminated as it fills, so free_node() can undo it.
+    size_t k = 0;
+    if (job->infile != NULL) {
+        node->reads[k++] = analyze_strdup(job->infile);
+    }
+    for (size_t i = 0; job->inputs && job->inputs[i] != NULL &&
+                       (k == 0 || node->reads[k - 1] != NULL); i++) {
+        node->reads[k++] = analyze_strdup(job->inputs[i]);
+    }
+    if (k > 0 && node->reads[k - 1] == NULL) {
+        free_node(node);
+        return -1;
+    }
+
+    num_nodes++;
+    return link_node(num_nodes - 1);
+}
+
+void
+analyze_job_started(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &job_start);
+}
+
+void
+analyze_job_finished(const job_t *job, const char *text)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (double)(end.tv_sec - job_start.tv_sec) +
+                  (double)(end.tv_nsec - job_start.tv_nsec) / 1e9;
+    if (analyze_add_job(job, text, secs) < 0) {
+        print_mysh_error("report", "out of memory");
+    }
+}
+
+void
+analyze_reset(void)
+{
+    for (size_t i = 0; i < num_nodes; i++) {
+        free_node(&nodes[i]);
+    }
+    free(nodes);
+    nodes = NULL;
+    num_nodes = 0;
+    cap_nodes = 0;
+}
+
+double
+analyze_critical_path(double *total_work)
+{
+    double work = 0.0, longest = 0.0;
+    for (size_t i = 0; i < num_nodes; i++) {
+        analyze_node_t *node = &nodes[i];
+        double start = 0.0;
+        node->via = SIZE_MAX;
+        for (size_t d = 0; d < node->num_deps; d++) {
+            if (nodes[node->deps[d]].finish > start || node->via == SIZE_MAX) {
+                start = nodes[node->deps[d]].finish;
+                node->via = node->deps[d];
+            }
+        }
+        node->finish = start + node->weight;
+        work += node->weight;
+        if (node->finish > longest) {
+            longest = node->finish;
+        }
+    }
+    if (total_work != NULL) {
+        *total_work = work;
+    }
+    return longest;
+}
+
+void
+analyze_report(FILE *out, bool measured)
+{
+    double work = 0.0;
+    double span = analyze_critical_path(&work);
+
+    // Mark the critical path by walking back from the latest finisher.
+    bool *on_path = calloc(num_nodes + 1, sizeof(bool));
+    size_t last = SIZE_MAX;
+    for (size_t i = 0; i < num_nodes; i++) {
+        if (last == SIZE_MAX || nodes[i].finish > nodes[last].finish) {
+            last = i;
+        }
+    }
+    size_t path_len = 0;
+    for (size_t i = last; i != SIZE_MAX && on_path != NULL; i = nodes[i].via) {
+        on_path[i] = true;
+        path_len++;
+    }
+
+    fprintf(out, "%5s %10s  %-14s %s\n", "job", measured ? "time" : "", "deps", "command");
+    for (size_t i = 0; i < num_nodes; i++) {
+        char deps[64] = "-";
+        size_t used = 0;
+        for (size_t d = 0; d < nodes[i].num_deps && used < sizeof(deps); d++) {
+            int n = snprintf(deps + used, sizeof(deps) - used, "%s%zu",
+                             d ? "," : "", nodes[i].deps[d] + 1);
+            used += (n > 0) ? (size_t)n : 0;
+        }
+        if (used >= sizeof(deps)) {
+            memcpy(deps + sizeof(deps) - 4, "...", 4);
+        }
+
+        char time[32] = "";
+        if (measured) {
+            snprintf(time, sizeof(time), "%.3fs", nodes[i].weight);
+        }
+        fprintf(out, "%c%4zu %10s  %-14s %s\n", (on_path && on_path[i]) ? '*' : ' ',
+                i + 1, time, deps, nodes[i].text);
+    }
+
+    if (measured) {
+        fprintf(out, "critical path (*): %zu jobs, %.3fs\n", path_len, span);
+        fprintf(out, "total work:        %.3fs\n", work);
+    } else {
+        fprintf(out, "critical path (*): %zu jobs\n", path_len);
+        fprintf(out, "total work:        %zu jobs\n", num_nodes);
+    }
+    if (span > 0.0) {
+        fprintf(out, "max speedup:       %.2fx\n", work / span);
+    }
+    free(on_path);
+}
+
+int
+analyze_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        print_mysh_error(path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        char *copy = analyze_strdup(line);
+        if (copy == NULL) {
+            break;
+        }
+
+        // Each job of a chain is its own node; its and/or edge is explicit.
+        chain_t chain = (chain_t){0};
+        if (parse_chain(copy, &chain) > 0) {
+            for (size_t i = 0; i < chain.num_jobs; i++) {
+                if (analyze_add_job(&chain.jobs[i], chain.texts[i], 1.0) < 0) {
+                    print_mysh_error("analyze", "out of memory");
+                    break;
+                }
+            }
+        }
+        free_chain(&chain);
+        free(copy);
+    }
+    free(line);
+    fclose(f);
+
+    analyze_report(stdout, false);
+    analyze_reset();
+    return EXIT_SUCCESS;
+}
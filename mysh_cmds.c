@@ -4,10 +4,14 @@
 //   - Executing parsed jobs (simple commands + pipelines)
 //   - Handling input/output redirection
 //   - Handling /dev/null behavior for non-tty input
-//   - Implementing built-in commands: cd, pwd, which, exit, die
+//   - Implementing built-in commands: cd, pwd, which, exit, die, jobclass,
+//     coproc, waitfor
+//   - Coprocesses: long-lived helpers reachable through "@co:NAME" redirects
 //
 // Parsing, the main input loop, and conditionals belong in mysh_core.c.
 
+#define _GNU_SOURCE
+
 #include "mysh.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,8 +20,50 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define MAX_COPROCS     16
+#define COPROC_PREFIX   "@co:"
+#define SCRIPT_SUFFIX   ".mysh"   // runs as a mysh script even without "#!"
+#define SHEBANG_MAX     256
+
+// A running coprocess: the shell keeps the write end of its stdin and the
+// read end of its stdout (both close-on-exec, so only jobs that redirect to
+// "@co:NAME" ever hold them).
+typedef struct {
+    char  *name;
+    pid_t  pid;
+    int    to_fd;
+    int    from_fd;
+    bool   reaped;     // waited for by the scheduler; wstatus is its status
+    int    wstatus;
+} coproc_t;
+
+static coproc_t coprocs[MAX_COPROCS];
+
+// Atomic output ('>!'): the job writes to an unnamed O_TMPFILE in the
+// target's directory (or, where that is unsupported, a hidden mkstemp file)
+// and the result replaces the target only if the job exits 0.
+typedef struct {
+    pid_t  pid;        // last stage of the job; 0 for a parent built-in
+    int    fd;         // the open temporary file
+    char  *target;
+    char  *tmp_path;   // mkstemp fallback only; NULL for O_TMPFILE
+} atomic_out_t;
+
+static atomic_out_t *atomic_outs;     // launched jobs not yet reaped
+static size_t        num_atomic_outs;
+static int           atomic_child_fd = -1;  // while forking: the child's stdout
 
 /* Minimal strdup helper (avoids relying on non-standard strdup). */
 static char *my_strdup(const char *s) {
@@ -30,8 +76,18 @@ static char *my_strdup(const char *s) {
     return p;
 }
 
+static exec_action_t run_perfstat(const job_t *job, bool input_is_tty,
+                                  int *cmd_status);
+static void wait_for_perf_gate(void);
+static exec_action_t run_bench(const job_t *job, bool input_is_tty,
+                               int *cmd_status);
 static int  run_simple_command(const job_t *job, bool input_is_tty);
 static int  run_pipeline(const job_t *job, bool input_is_tty);
+static int  launch_simple_command(const job_t *job, bool input_is_tty,
+                                  pid_t *pid_out);
+static int  launch_pipeline(const job_t *job, size_t first, bool input_is_tty,
+                            pid_t *pids, int *feed_fd);
+static int  wait_for_children(const pid_t *pids, size_t n);
 
 static int  setup_redirection(const char *infile,
                               const char *outfile,
@@ -41,19 +97,25 @@ static int  setup_stdin_for_batch(bool input_is_tty);
 
 static int  open_input_file(const char *path);
 static int  open_output_file(const char *path);
+static int  open_atomic_output(const char *target, atomic_out_t *out);
+static void commit_atomic_output(atomic_out_t *out, bool keep);
 
-static int  is_builtin(const char *name);
 static int  run_builtin_parent(char *const argv[], int *status_out,
                                exec_action_t *action_out);
 static int  run_builtin_child(char *const argv[]);  // builtins when used in pipelines
+static int  run_parent_plugin(const job_t *job, bool input_is_tty);
 
 static int  builtin_cd(char *const argv[]);
 static int  builtin_pwd(char *const argv[]);
 static int  builtin_which(char *const argv[]);
 static int  builtin_exit(char *const argv[], exec_action_t *action_out);
 static int  builtin_die(char *const argv[], exec_action_t *action_out);
+static int  builtin_jobclass(char *const argv[]);
+static int  builtin_coproc(char *const argv[]);
+static int  builtin_waitfor(char *const argv[]);
+
+static coproc_t *find_coproc(const char *name);
 
-static char *resolve_program_path(const char *cmd_name);
 
 // Public entry point for executing a single parsed job.
 exec_action_t
@@ -73,6 +135,13 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
         return EXEC_CONTINUE;
     }
 
+    if (job->bench_runs > 0) {
+        return run_bench(job, input_is_tty, cmd_status);
+    }
+    if (job->perfstat) {
+        return run_perfstat(job, input_is_tty, cmd_status);
+    }
+
     // Scan for exit/die anywhere in the job so we can honor
     // "jobs involving exit/die terminate the shell" even in pipelines.
     bool has_exit = false;
@@ -82,20 +151,23 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
             continue;
         }
         const char *cmd = job->argvv[i][0];
-        if (strcmp(cmd, "die") == 0) {
+        if (is_word(cmd, WORD_DIE)) {
             has_die = true;
-        } else if (strcmp(cmd, "exit") == 0) {
+        } else if (is_word(cmd, WORD_EXIT)) {
             has_exit = true;
         }
     }
 
     // Special handling for a single built-in command in the parent process
     // so that cd/exit/die affect the shell itself. We also honor
-    // redirection (<, >) for these built-ins.
+    // redirection (<, >) for these built-ins. Plugin builtins run here only
+    // if they allow it; the others get a child like an external command.
     if (job->num_procs == 1 &&
         job->argvv[0] != NULL &&
         job->argvv[0][0] != NULL &&
-        is_builtin(job->argvv[0][0])) {
+        is_builtin(job->argvv[0][0]) &&
+        (plugin_flags(job->argvv[0][0]) == 0 ||
+         (plugin_flags(job->argvv[0][0]) & MYSH_BUILTIN_PARENT) != 0)) {
 
         int status = 1;
         exec_action_t builtin_action = EXEC_CONTINUE;
@@ -103,6 +175,7 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
         int saved_stdin  = -1;
         int saved_stdout = -1;
         int redir_error  = 0;
+        atomic_out_t parent_out = { .fd = -1 };
 
         // Apply redirection in the parent if requested.
         // Save fds so we can restore them after running the builtin.
@@ -140,7 +213,14 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
 
             // Set up stdout to outfile if present
             if (redir_error == 0 && job->outfile != NULL) {
-                int fd_out = open_output_file(job->outfile);
+                int fd_out = -1;
+                if (job->atomic_out) {
+                    if (open_atomic_output(job->outfile, &parent_out) == 0) {
+                        fd_out = dup(parent_out.fd);
+                    }
+                } else {
+                    fd_out = open_output_file(job->outfile);
+                }
                 if (fd_out < 0) {
                     redir_error = -1;
                 } else {
@@ -155,7 +235,9 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
             }
         }
 
-        if (redir_error == 0) {
+        if (redir_error == 0 && plugin_flags(job->argvv[0][0]) != 0) {
+            status = run_parent_plugin(job, input_is_tty);
+        } else if (redir_error == 0) {
             if (run_builtin_parent(job->argvv[0], &status, &builtin_action) < 0) {
                 status = 1;
             }
@@ -171,11 +253,15 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
             close(saved_stdin);
         }
         if (saved_stdout != -1) {
+            fflush(stdout);
             if (dup2(saved_stdout, STDOUT_FILENO) < 0) {
                 perror("dup2");
             }
             close(saved_stdout);
         }
+        if (parent_out.fd >= 0) {
+            commit_atomic_output(&parent_out, redir_error == 0 && status == 0);
+        }
 
         if (cmd_status != NULL) {
             *cmd_status = status;
@@ -230,6 +316,337 @@ execute_job(const job_t *job, bool input_is_tty, int *cmd_status)
 }
 
 
+// "bench [-n N] [-w W] job": run the job W times untimed, then N times
+// timed, each through execute_job() itself. Between iterations we only read
+// the clock; statistics and rusage are worked out after the last run.
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double
+timespec_ms(const struct timespec *t)
+{
+    return t->tv_sec * 1e3 + t->tv_nsec / 1e6;
+}
+
+static double
+timeval_ms(const struct timeval *t)
+{
+    return t->tv_sec * 1e3 + t->tv_usec / 1e3;
+}
+
+// While bench runs its timed iterations: the largest RSS of any process
+// wait_for_children() has reaped, else -1. RUSAGE_CHILDREN can't give this;
+// its ru_maxrss covers every child the shell has ever reaped.
+static long bench_maxrss = -1;
+
+static exec_action_t
+run_bench(const job_t *job, bool input_is_tty, int *cmd_status)
+{
+    job_t once = *job;
+    once.bench_runs = 0;
+    once.bench_warmup = 0;
+
+    size_t runs = job->bench_runs;
+    double *samples = malloc(runs * sizeof(double));
+    if (samples == NULL) {
+        perror("malloc");
+        return EXEC_CONTINUE;
+    }
+
+    exec_action_t action = EXEC_CONTINUE;
+    for (size_t i = 0; i < job->bench_warmup && action == EXEC_CONTINUE; i++) {
+        action = execute_job(&once, input_is_tty, cmd_status);
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_CHILDREN, &before);
+    bench_maxrss = 0;
+
+    size_t done = 0;
+    while (done < runs && action == EXEC_CONTINUE) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        action = execute_job(&once, input_is_tty, cmd_status);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[done++] = timespec_ms(&end) - timespec_ms(&start);
+    }
+
+    getrusage(RUSAGE_CHILDREN, &after);
+    long maxrss = bench_maxrss;
+    bench_maxrss = -1;
+
+    if (done > 0) {
+        double sum = 0.0;
+        for (size_t i = 0; i < done; i++) {
+            sum += samples[i];
+        }
+        double mean = sum / done;
+        double var = 0.0;
+        for (size_t i = 0; i < done; i++) {
+            var += (samples[i] - mean) * (samples[i] - mean);
+        }
+        double stddev = done > 1 ? sqrt(var / (done - 1)) : 0.0;
+
+        qsort(samples, done, sizeof(double), compare_double);
+        double median = (done % 2) ? samples[done / 2]
+                                   : (samples[done / 2 - 1] + samples[done / 2]) / 2;
+        size_t p99 = (size_t)ceil(0.99 * done) - 1;
+
+        fprintf(stderr,
+                "bench: %zu runs (%zu warmup): min %.3f ms  median %.3f ms  "
+                "p99 %.3f ms  stddev %.3f ms\n",
+                done, job->bench_warmup, samples[0], median, samples[p99], stddev);
+        fprintf(stderr,
+                "bench: children total: user %.3f ms  sys %.3f ms  "
+                "minflt %ld  majflt %ld  nvcsw %ld  nivcsw %ld\n",
+                timeval_ms(&after.ru_utime) - timeval_ms(&before.ru_utime),
+                timeval_ms(&after.ru_stime) - timeval_ms(&before.ru_stime),
+                after.ru_minflt - before.ru_minflt,
+                after.ru_majflt - before.ru_majflt,
+                after.ru_nvcsw - before.ru_nvcsw,
+                after.ru_nivcsw - before.ru_nivcsw);
+        fprintf(stderr, "bench: largest process of a timed run: maxrss %ld KB\n",
+                maxrss);
+    }
+
+    free(samples);
+    return action;
+}
+
+
+// "perfstat job": count perf events for each stage of the job. Every stage
+// is held at a gate just before exec while the parent attaches its counters
+// (disabled, enable_on_exec, inherit -- so the counts cover exactly the
+// program and whatever it forks). Each stage is read once it is reaped.
+// Hardware events are optional; if the PMU is missing or off limits, the
+// software events are still reported.
+typedef struct {
+    uint32_t    type;
+    uint64_t    config;
+    const char *name;
+} perf_counter_t;
+
+static const perf_counter_t perf_counters[] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       "task-clock" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      "page-faults" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     "instructions" },
+};
+#define NUM_PERF_COUNTERS (sizeof(perf_counters) / sizeof(perf_counters[0]))
+#define PERF_TASK_CLOCK   0
+#define PERF_CYCLES       3
+#define PERF_INSTRUCTIONS 4
+
+// The gate's ends while a perfstat job is being launched, else -1.
+static int perf_gate_fd      = -1;
+static int perf_gate_release = -1;
+
+// Child side: block until the parent has attached the counters. The
+// child's copy of the write end is closed first, so that if the parent
+// gives up on the launch and closes its own, the read sees EOF; the stage
+// then exits without running.
+static void
+wait_for_perf_gate(void)
+{
+    if (perf_gate_fd >= 0) {
+        if (perf_gate_release >= 0) {
+            close(perf_gate_release);
+            perf_gate_release = -1;
+        }
+        char c;
+        ssize_t n;
+        while ((n = read(perf_gate_fd, &c, 1)) < 0 && errno == EINTR) {
+        }
+        if (n <= 0) {
+            _exit(1);
+        }
+        close(perf_gate_fd);
+        perf_gate_fd = -1;
+    }
+}
+
+// Parent side: a launch that failed part way lets its stages see EOF on
+// the gate before abort_pipeline() waits for them.
+static void
+close_perf_gate_release(void)
+{
+    if (perf_gate_release >= 0) {
+        close(perf_gate_release);
+        perf_gate_release = -1;
+    }
+}
+
+// Open one counter on pid. Kernel-side counting is tried first and dropped
+// if perf_event_paranoid forbids it; *user_only reports which one we got.
+static int
+open_perf_counter(const perf_counter_t *counter, pid_t pid, bool *user_only)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = counter->type;
+    attr.config         = counter->config;
+    attr.disabled       = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit        = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                          PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    *user_only = false;
+    int fd = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        *user_only = true;
+        fd = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+// Read a counter, scaled up if it was multiplexed. Returns -1 if unread.
+static double
+read_perf_counter(int fd)
+{
+    uint64_t buf[3];  // value, time enabled, time running
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        return -1.0;
+    }
+    if (buf[2] == 0) {
+        return buf[1] == 0 ? 0.0 : -1.0;
+    }
+    return (double)buf[0] * ((double)buf[1] / (double)buf[2]);
+}
+
+static void
+print_perf_stage(size_t stage, const char *name, const int *fds, const bool *user_only)
+{
+    double value[NUM_PERF_COUNTERS];
+    for (size_t c = 0; c < NUM_PERF_COUNTERS; c++) {
+        value[c] = read_perf_counter(fds[c]);
+    }
+
+    fprintf(stderr, "perfstat: stage %zu (%s):", stage, name);
+    for (size_t c = 0; c < NUM_PERF_COUNTERS; c++) {
+        if (value[c] < 0) {
+            continue;
+        }
+        if (c == PERF_TASK_CLOCK) {
+            fprintf(stderr, "  %s %.3f ms", perf_counters[c].name, value[c] / 1e6);
+        } else {
+            fprintf(stderr, "  %s %.0f", perf_counters[c].name, value[c]);
+        }
+        if (user_only[c]) {
+            fprintf(stderr, " (user)");
+        }
+    }
+    if (value[PERF_CYCLES] > 0 && value[PERF_INSTRUCTIONS] >= 0) {
+        fprintf(stderr, "  IPC %.2f", value[PERF_INSTRUCTIONS] / value[PERF_CYCLES]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static exec_action_t
+run_perfstat(const job_t *job, bool input_is_tty, int *cmd_status)
+{
+    job_t once = *job;
+    once.perfstat = false;
+
+    // Built-ins never exec, so there would be nothing to count.
+    for (size_t i = 0; i < job->num_procs; i++) {
+        if (job->argvv[i] == NULL || job->argvv[i][0] == NULL ||
+            is_builtin(job->argvv[i][0])) {
+            fprintf(stderr, "perfstat: job has a built-in; running it uncounted\n");
+            return execute_job(&once, input_is_tty, cmd_status);
+        }
+    }
+
+    size_t n = job->num_procs;
+    int gate[2];
+    if (pipe2(gate, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return execute_job(&once, input_is_tty, cmd_status);
+    }
+
+    pid_t pids[MAX_COMMANDS];
+    perf_gate_fd = gate[0];
+    perf_gate_release = gate[1];
+    int rc = launch_job(&once, input_is_tty, pids);
+    perf_gate_fd = -1;
+    if (rc < 0) {
+        close(gate[0]);
+        close_perf_gate_release();  // unless abort_pipeline() already did
+        return EXEC_CONTINUE;
+    }
+    perf_gate_release = -1;
+
+    int  fds[MAX_COMMANDS][NUM_PERF_COUNTERS];
+    bool user_only[MAX_COMMANDS][NUM_PERF_COUNTERS];
+    int  hw_errno = 0;
+    int  last_errno = 0;   // from the last failed perf_event_open
+    size_t opened = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t c = 0; c < NUM_PERF_COUNTERS; c++) {
+            fds[i][c] = open_perf_counter(&perf_counters[c], pids[i], &user_only[i][c]);
+            if (fds[i][c] >= 0) {
+                opened++;
+                continue;
+            }
+            last_errno = errno;
+            if (perf_counters[c].type == PERF_TYPE_HARDWARE) {
+                hw_errno = errno;
+            }
+        }
+    }
+
+    // Release every stage: one byte each.
+    char go[MAX_COMMANDS] = {0};
+    if (write(gate[1], go, n) != (ssize_t)n) {
+        perror("write");
+    }
+    close(gate[0]);
+    close(gate[1]);
+
+    if (opened == 0) {
+        fprintf(stderr, "perfstat: perf events unavailable: %s\n", strerror(last_errno));
+    } else if (hw_errno != 0) {
+        fprintf(stderr, "perfstat: hardware counters unavailable (%s); "
+                        "software events only\n", strerror(hw_errno));
+    }
+
+    int status = 1;
+    for (size_t i = 0; i < n; i++) {
+        int wstatus = 0;
+        if (waitpid(pids[i], &wstatus, 0) < 0) {
+            perror("waitpid");
+        } else {
+            flight_record(FLIGHT_REAP, pids[i], wstatus);
+            if (i == n - 1) {
+                finish_atomic_output(pids[i], wstatus);
+                status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+            }
+        }
+        if (opened > 0) {
+            print_perf_stage(i, job->argvv[i][0], fds[i], user_only[i]);
+        }
+        for (size_t c = 0; c < NUM_PERF_COUNTERS; c++) {
+            if (fds[i][c] >= 0) {
+                close(fds[i][c]);
+            }
+        }
+    }
+
+    if (cmd_status != NULL) {
+        *cmd_status = status;
+    }
+    return EXEC_CONTINUE;
+}
+
+
 // Simple command execution (no pipelines).
 static int
 run_simple_command(const job_t *job, bool input_is_tty)
@@ -241,10 +658,37 @@ run_simple_command(const job_t *job, bool input_is_tty)
         return 0; // treat empty as success
     }
 
+    pid_t pid;
+    if (launch_simple_command(job, input_is_tty, &pid) < 0) {
+        return 1;
+    }
+    return wait_for_children(&pid, 1);
+}
+
+// Fork the single process of a simple command; does not wait for it.
+static int
+launch_simple_command(const job_t *job, bool input_is_tty, pid_t *pid_out)
+{
+    char *const *argv = job->argvv[0];
+
+    atomic_out_t out = { .fd = -1 };
+    if (job->atomic_out && job->outfile != NULL) {
+        if (open_atomic_output(job->outfile, &out) < 0) {
+            return -1;
+        }
+        atomic_child_fd = out.fd;
+    }
+
     pid_t pid = fork();
+    if (pid != 0) {
+        atomic_child_fd = -1;
+    }
     if (pid < 0) {
         perror("fork");
-        return 1;
+        if (out.fd >= 0) {
+            commit_atomic_output(&out, false);
+        }
+        return -1;
     }
 
     if (pid == 0) {
@@ -255,16 +699,21 @@ run_simple_command(const job_t *job, bool input_is_tty)
 
         // Builtin in a child (e.g., because of redirection decisions or tests)
         if (is_builtin(argv[0])) {
-            (void)run_builtin_child((char *const *)argv);
-            _exit(0);
+            _exit(run_builtin_child((char *const *)argv));
         }
 
-        // External command: resolve path and execv
-        char *path = resolve_program_path(argv[0]);
+        // External command: use the prepared path or resolve it, then execv
+        wait_for_perf_gate();
+        reaper_tag_child();
+        char *path = (job->paths != NULL && job->paths[0] != NULL)
+                         ? job->paths[0] : resolve_program_path(argv[0]);
         if (path == NULL) {
             fprintf(stderr, "%s: command not found\n", argv[0]);
             _exit(127);
         }
+        if (is_nested_script(path, argv)) {
+            _exit(run_nested_script(path));
+        }
 
         execv(path, argv);
         perror("execv");
@@ -272,25 +721,111 @@ run_simple_command(const job_t *job, bool input_is_tty)
         _exit(127);
     }
 
-    // Parent: wait for the child
-    int wstatus = 0;
-    if (waitpid(pid, &wstatus, 0) < 0) {
-        perror("waitpid");
-        return 1;
+    flight_record(FLIGHT_SPAWN, pid, 0);
+    if (out.fd >= 0) {
+        atomic_out_t *grown =
+            realloc(atomic_outs, (num_atomic_outs + 1) * sizeof(*atomic_outs));
+        if (grown == NULL) {
+            // Can't track it: the target is left alone, the output dropped.
+            perror("realloc");
+            commit_atomic_output(&out, false);
+        } else {
+            out.pid = pid;
+            atomic_outs = grown;
+            atomic_outs[num_atomic_outs++] = out;
+        }
     }
+    *pid_out = pid;
+    return 0;
+}
 
-    if (WIFEXITED(wstatus)) {
-        return WEXITSTATUS(wstatus);
-    } else {
-        // Treat abnormal termination as failure
-        return 1;
+// Wait for the given children. The job's status is the exit code of the
+// last one; abnormal termination counts as failure.
+static int
+wait_for_children(const pid_t *pids, size_t n)
+{
+    int last_status = 1;
+    for (size_t i = 0; i < n; i++) {
+        int wstatus = 0;
+        struct rusage ru;
+        if (native_wait(pids[i], &wstatus, &ru) == -1) {
+            perror("waitpid");
+            continue;
+        }
+        if (bench_maxrss >= 0 && ru.ru_maxrss > bench_maxrss) {
+            bench_maxrss = ru.ru_maxrss;
+        }
+        flight_record(FLIGHT_REAP, pids[i], wstatus);
+        if (i == n - 1) {
+            finish_atomic_output(pids[i], wstatus);
+        }
+        if (i == n - 1 && WIFEXITED(wstatus)) {
+            last_status = WEXITSTATUS(wstatus);
+        }
+    }
+
+    return last_status;
+}
+
+// Public entry point for starting a job without waiting (used by the
+// concurrent scheduler).
+int
+launch_job(const job_t *job, bool input_is_tty, pid_t *pids)
+{
+    if (job == NULL || job->num_procs == 0 || job->argvv == NULL) {
+        return -1;
     }
+    if (job->num_procs == 1) {
+        if (job->argvv[0] == NULL || job->argvv[0][0] == NULL) {
+            return -1;
+        }
+        return launch_simple_command(job, input_is_tty, &pids[0]) < 0 ? -1 : 1;
+    }
+    return launch_pipeline(job, 0, input_is_tty, pids, NULL);
 }
 
 
+// Public entry point for starting a whole chain without waiting (used by
+// the concurrent scheduler). The forked shell runs each job as it would in
+// the foreground and _exit()s, so nothing the parent buffered or registered
+// with atexit() runs twice.
+int
+launch_chain(const chain_t *chain, int status, bool input_is_tty, pid_t *pid)
+{
+    if (chain == NULL || chain->num_jobs == 0) {
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (child == 0) {
+        native_after_fork();
+        reaper_tag_child();
+        for (size_t i = 0; i < chain->num_jobs; i++) {
+            const job_t *job = &chain->jobs[i];
+            if ((job->cond == COND_AND && status != 0) ||
+                (job->cond == COND_OR && status == 0)) {
+                continue;  // skipped: the status carries over
+            }
+            (void)execute_job(job, input_is_tty, &status);
+        }
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    *pid = child;
+    return 0;
+}
+
 // Pipeline execution
-// For N processes, there are N-1 pipes. We:
-//   - set up all pipes
+// For N processes, there are up to N-1 pipes (none between native stages
+// the shell fuses). We:
+//   - set up the pipes
 //   - fork each child, wiring its stdin/stdout to the correct pipe ends
 //   - handle builtin vs external for each stage
 //   - close all pipes in the parent
@@ -304,48 +839,220 @@ run_pipeline(const job_t *job, bool input_is_tty)
         return run_simple_command(job, input_is_tty);
     }
 
-    int pipes[n - 1][2];
     pid_t pids[n];
+    if (is_native_generator(job->argvv[0])) {
+        // The shell itself runs stage 0 and the native filters right after
+        // it, passing buffers between them: no fork and no pipe for those.
+        size_t fused = 1;
+        while (fused < n && is_native_filter(job->argvv[fused])) {
+            fused++;
+        }
+        if (fused == n) {
+            fflush(stdout);
+            int status = run_native_stages(job->argvv, n, STDOUT_FILENO);
+            return status < 0 ? 1 : status;
+        }
 
-    // Create pipes
-    for (size_t i = 0; i < n - 1; i++) {
-        if (pipe(pipes[i]) < 0) {
-            perror("pipe");
-            // no children yet, just bail
+        int feed_fd = -1;
+        int num_pids = launch_pipeline(job, fused, input_is_tty, pids, &feed_fd);
+        if (num_pids < 0) {
             return 1;
         }
+        (void)run_native_stages(job->argvv, fused, feed_fd);
+        close(feed_fd);
+        return wait_for_children(pids, (size_t)num_pids);
     }
 
-    // Fork each process in the pipeline
+    int num_pids = launch_pipeline(job, 0, input_is_tty, pids, NULL);
+    if (num_pids < 0) {
+        return 1;
+    }
+
+    // Pipeline success is the exit code of the last one.
+    return wait_for_children(pids, (size_t)num_pids);
+}
+
+static void
+close_pipe_end(int fd)
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Undo a partly launched pipeline: stop the coroutines and close the pipes
+// (a coroutine's pipe ends are its own), then wait for the children forked
+// so far, after letting them out of a perfstat gate (they exit unrun).
+// stage_pids[k] is stage k's pid, or 0 if it never started; every stage of
+// a fused run holds the run's pseudo pid.
+static void
+abort_pipeline(size_t n, int pipes[][2], const pid_t *stage_pids)
+{
+    for (size_t k = 0; k < n; k++) {
+        if (stage_pids[k] < -1) {
+            native_cancel(stage_pids[k]);  // once per run; repeats are no-ops
+        }
+    }
+    for (size_t k = 0; k < n - 1; k++) {
+        if (stage_pids[k + 1] >= -1) {
+            close_pipe_end(pipes[k][0]);
+        }
+        if (stage_pids[k] >= -1) {
+            close_pipe_end(pipes[k][1]);
+        }
+    }
+    close_perf_gate_release();
+    for (size_t k = 0; k < n; k++) {
+        int wstatus;
+        if (stage_pids[k] > 0) {
+            waitpid(stage_pids[k], &wstatus, 0);
+        }
+    }
+}
+
+// Create the pipes after stages [from, to); -1 on failure.
+static int
+open_pipes(int pipes[][2], size_t from, size_t to)
+{
+    for (size_t k = from; k < to; k++) {
+        if (pipe(pipes[k]) < 0) {
+            perror("pipe");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Run stage i, a thread-safe plugin builtin, on a thread in the shell with
+// the stage's pipe ends (or stdin / stdout at the ends of the pipeline).
+// Returns its pseudo pid, or -1 with the pipes left alone.
+static pid_t
+start_plugin_thread(const job_t *job, size_t i, bool input_is_tty, int pipes[][2])
+{
+    size_t n = job->num_procs;
+    int in = -1;
+    if (i > 0) {
+        in = pipes[i - 1][0];
+    } else if (input_is_tty) {
+        in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    } else {
+        in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    int out = (i < n - 1) ? pipes[i][1] : fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    pid_t pid = -1;
+    if (in >= 0 && out >= 0) {
+        fflush(stdout);
+        pid = plugin_thread_start(job->argvv[i], in, out);
+    }
+    if (pid == -1) {
+        if (i == 0 && in >= 0) {
+            close(in);
+        }
+        if (i == n - 1 && out >= 0) {
+            close(out);
+        }
+    }
+    return pid;
+}
+
+// Fork every stage of a pipeline from stage first on, wired together;
+// does not wait for them. Stages before first are the caller's: *feed_fd
+// gets the write end of the pipe into stage first, to fill and close.
+//
+// A run of adjacent native filter stages (after the first stage, not under
+// perfstat or a feed) becomes one coroutine in the shell, and only the boundaries
+// with real processes get pipes. A plugin builtin that allows it runs on a
+// thread instead of a child. pids receives one pid per process, coroutine
+// or thread, in pipeline order; returns how many, or -1.
+static int
+launch_pipeline(const job_t *job, size_t first, bool input_is_tty,
+                pid_t *pids, int *feed_fd)
+{
+    size_t n = job->num_procs;
+    int pipes[n - 1][2];
+    pid_t stage_pids[n];
+    size_t run_end[n];  // for a native stage: the last stage of its run
+    bool native[n];
+    int num_pids = 0;
+
+    // Plan the fused runs; a pipe is needed wherever a run ends. While the
+    // caller feeds stage first it blocks outside the event loop, so no
+    // coroutine could drain the pipeline: every stage gets a process then.
     for (size_t i = 0; i < n; i++) {
+        stage_pids[i] = 0;
+        native[i] = first == 0 && i > 0 && perf_gate_fd < 0 &&
+                    job->argvv[i] != NULL && is_native_filter(job->argvv[i]);
+    }
+    for (size_t i = n; i-- > 0;) {
+        run_end[i] = (native[i] && i + 1 < n && native[i + 1]) ? run_end[i + 1] : i;
+    }
+    for (size_t k = 0; k < n - 1; k++) {
+        pipes[k][0] = pipes[k][1] = -1;
+    }
+    for (size_t k = (first > 0) ? first - 1 : 0; k < n - 1; k++) {
+        if (!(native[k] && native[k + 1]) && open_pipes(pipes, k, k + 1) < 0) {
+            abort_pipeline(n, pipes, stage_pids);
+            return -1;
+        }
+    }
+
+    // Fork each process in the pipeline
+    for (size_t i = first; i < n; i++) {
         char *const *argv = job->argvv[i];
         if (argv == NULL || argv[0] == NULL) {
             fprintf(stderr, "mysh: empty command in pipeline\n");
             // best effort: close pipes, wait for already-forked children
-            for (size_t k = 0; k < n - 1; k++) {
-                close(pipes[k][0]);
-                close(pipes[k][1]);
+            abort_pipeline(n, pipes, stage_pids);
+            return -1;
+        }
+
+        if (perf_gate_fd < 0 && (plugin_flags(argv[0]) & MYSH_BUILTIN_THREAD)) {
+            pid_t t = start_plugin_thread(job, i, input_is_tty, pipes);
+            if (t < -1) {
+                stage_pids[i] = t;
+                pids[num_pids++] = t;
+                continue;
             }
-            for (size_t k = 0; k < i; k++) {
-                int wstatus;
-                waitpid(pids[k], &wstatus, 0);
+            // Couldn't start the thread: the stage gets a child instead.
+        }
+
+        if (native[i]) {
+            size_t end = run_end[i];
+            bool last = (end == n - 1);
+            bool own = true;
+            int out = last ? native_open_stdout(&own) : pipes[end][1];
+            pid_t co = (out >= 0) ? native_filter_start(job->argvv + i, end - i + 1,
+                                                        pipes[i - 1][0], out, own)
+                                  : -1;
+            if (co < -1) {
+                for (size_t k = i; k <= end; k++) {
+                    stage_pids[k] = co;
+                }
+                pids[num_pids++] = co;
+                i = end;
+                continue;
+            }
+            if (last && out >= 0) {
+                close(out);
+            }
+            // Couldn't start it natively: fork the real programs instead,
+            // with the pipes the fused run didn't need.
+            for (size_t k = i; k <= end; k++) {
+                native[k] = false;
+            }
+            if (open_pipes(pipes, i, end) < 0) {
+                abort_pipeline(n, pipes, stage_pids);
+                return -1;
             }
-            return 1;
         }
 
         pid_t pid = fork();
         if (pid < 0) {
             perror("fork");
             // Clean up: close pipes, wait for already-forked children
-            for (size_t k = 0; k < n - 1; k++) {
-                close(pipes[k][0]);
-                close(pipes[k][1]);
-            }
-            for (size_t k = 0; k < i; k++) {
-                int wstatus;
-                waitpid(pids[k], &wstatus, 0);
-            }
-            return 1;
+            abort_pipeline(n, pipes, stage_pids);
+            return -1;
         }
 
         if (pid == 0) {
@@ -375,22 +1082,27 @@ run_pipeline(const job_t *job, bool input_is_tty)
 
             // Close all pipe FDs in the child (we only need stdin/stdout now)
             for (size_t k = 0; k < n - 1; k++) {
-                close(pipes[k][0]);
-                close(pipes[k][1]);
+                close_pipe_end(pipes[k][0]);
+                close_pipe_end(pipes[k][1]);
             }
 
             // Builtin in a pipeline: run in child so it can participate
             if (is_builtin(argv[0])) {
-                (void)run_builtin_child((char *const *)argv);
-                _exit(0);
+                _exit(run_builtin_child((char *const *)argv));
             }
 
-            // External command: resolve path and execv
-            char *path = resolve_program_path(argv[0]);
+            // External command: use the prepared path or resolve it, then execv
+            wait_for_perf_gate();
+            reaper_tag_child();
+            char *path = (job->paths != NULL && job->paths[i] != NULL)
+                             ? job->paths[i] : resolve_program_path(argv[0]);
             if (path == NULL) {
                 fprintf(stderr, "%s: command not found\n", argv[0]);
                 _exit(127);
             }
+            if (is_nested_script(path, argv)) {
+                _exit(run_nested_script(path));
+            }
 
             execv(path, argv);
             perror("execv");
@@ -399,29 +1111,24 @@ run_pipeline(const job_t *job, bool input_is_tty)
         }
 
         // Parent: remember child PID
-        pids[i] = pid;
+        flight_record(FLIGHT_SPAWN, pid, (int32_t)i);
+        stage_pids[i] = pid;
+        pids[num_pids++] = pid;
     }
 
-    // Parent: close all pipe FDs
+    // Parent: close all pipe FDs, except those it feeds or a coroutine owns
     for (size_t k = 0; k < n - 1; k++) {
-        close(pipes[k][0]);
-        close(pipes[k][1]);
-    }
-
-    // Wait for all children. Pipeline success is the exit code of the last one.
-    int last_status = 1;
-    for (size_t i = 0; i < n; i++) {
-        int wstatus = 0;
-        if (waitpid(pids[i], &wstatus, 0) < 0) {
-            perror("waitpid");
-            continue;
+        if (stage_pids[k + 1] >= -1) {
+            close_pipe_end(pipes[k][0]);
         }
-        if (i == n - 1 && WIFEXITED(wstatus)) {
-            last_status = WEXITSTATUS(wstatus);
+        if (first > 0 && k == first - 1) {
+            *feed_fd = pipes[k][1];
+        } else if (stage_pids[k] >= -1) {
+            close_pipe_end(pipes[k][1]);
         }
     }
 
-    return last_status;
+    return num_pids;
 }
 
 // Redirection and /dev/null behavior.
@@ -486,10 +1193,43 @@ setup_stdin_for_batch(bool input_is_tty)
     return 0;
 }
 
+// "@co:NAME" targets: a new descriptor for the coprocess's stdout (input)
+// or stdin (output). Returns -1 if path is not a coprocess target, -2 if
+// it names no running coprocess.
+static int
+open_coproc_target(const char *path, bool for_output)
+{
+    if (strncmp(path, COPROC_PREFIX, strlen(COPROC_PREFIX)) != 0) {
+        return -1;
+    }
+
+    coproc_t *cp = find_coproc(path + strlen(COPROC_PREFIX));
+    if (cp == NULL) {
+        fprintf(stderr, "%s: no such coprocess\n", path);
+        return -2;
+    }
+
+    int fd = fcntl(for_output ? cp->to_fd : cp->from_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        perror(path);
+        return -2;
+    }
+    return fd;
+}
+
 static int
 open_input_file(const char *path)
 {
-    int fd = open(path, O_RDONLY);
+    int fd = open_coproc_target(path, false);
+    if (fd == -1) {
+        fd = open_shm_target(path, false);
+    }
+    if (fd != -1) {
+        return fd < 0 ? -1 : fd;
+    }
+
+    fd = open(path, O_RDONLY);
+    flight_record(FLIGHT_REDIRECT, fd < 0 ? -errno : fd, 0);
     if (fd < 0) {
         perror(path);
         return -1;
@@ -500,8 +1240,26 @@ open_input_file(const char *path)
 static int
 open_output_file(const char *path)
 {
+    if (atomic_child_fd >= 0) {
+        // Child of a '>!' job: write to the parent's temporary file.
+        int fd = dup(atomic_child_fd);
+        if (fd < 0) {
+            perror("dup");
+        }
+        return fd;
+    }
+
+    int fd = open_coproc_target(path, true);
+    if (fd == -1) {
+        fd = open_shm_target(path, true);
+    }
+    if (fd != -1) {
+        return fd < 0 ? -1 : fd;
+    }
+
     // Mode: 0640 (rw-r-----)
-    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    flight_record(FLIGHT_REDIRECT, fd < 0 ? -errno : fd, 1);
     if (fd < 0) {
         perror(path);
         return -1;
@@ -509,18 +1267,165 @@ open_output_file(const char *path)
     return fd;
 }
 
-// Built-in detection and dispatch.
+// Open the temporary file for a '>!' redirect to target. The file is
+// created in target's directory so that the final rename() stays within
+// one filesystem.
 static int
+open_atomic_output(const char *target, atomic_out_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd = -1;
+    if (target[0] == '@') {
+        fprintf(stderr, "mysh: %s: '>!' needs a file\n", target);
+        return -1;
+    }
+
+    out->target = my_strdup(target);
+    char *dir = my_strdup(target);
+    if (out->target == NULL || dir == NULL) {
+        perror("malloc");
+        goto fail;
+    }
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    out->fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0640);
+    if (out->fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+        // No O_TMPFILE here: use a hidden named file next to the target.
+        const char *base = slash ? strrchr(target, '/') + 1 : target;
+        size_t len = strlen(dir) + strlen(base) + sizeof("/..XXXXXX");
+        out->tmp_path = malloc(len);
+        if (out->tmp_path == NULL) {
+            perror("malloc");
+            goto fail;
+        }
+        snprintf(out->tmp_path, len, "%s/.%s.XXXXXX", dir, base);
+        out->fd = mkostemp(out->tmp_path, O_CLOEXEC);
+        if (out->fd >= 0) {
+            mode_t mask = umask(0);
+            umask(mask);
+            fchmod(out->fd, 0640 & ~mask);
+        }
+    }
+    flight_record(FLIGHT_REDIRECT, out->fd < 0 ? -errno : out->fd, 1);
+    if (out->fd < 0) {
+        perror(target);
+        goto fail;
+    }
+    free(dir);
+    return 0;
+
+fail:
+    free(dir);
+    free(out->target);
+    free(out->tmp_path);
+    out->target = NULL;
+    out->tmp_path = NULL;
+    return -1;
+}
+
+// Link a '>!' output over its target (keep) or throw it away (!keep).
+static void
+commit_atomic_output(atomic_out_t *out, bool keep)
+{
+    if (keep && out->tmp_path == NULL) {
+        // Give the unnamed file a temporary name, then rename it over the
+        // target; linkat() itself refuses to replace an existing file.
+        static unsigned long counter;
+        size_t len = strlen(out->target) + 64;
+        out->tmp_path = malloc(len);
+        if (out->tmp_path != NULL) {
+            snprintf(out->tmp_path, len, "%s.mysh-%ld-%lu",
+                     out->target, (long)getpid(), counter++);
+            char proc_path[64];
+            snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", out->fd);
+            if (linkat(out->fd, "", AT_FDCWD, out->tmp_path, AT_EMPTY_PATH) < 0 &&
+                linkat(AT_FDCWD, proc_path, AT_FDCWD, out->tmp_path,
+                       AT_SYMLINK_FOLLOW) < 0) {
+                perror(out->target);
+                free(out->tmp_path);
+                out->tmp_path = NULL;
+                keep = false;
+            }
+        } else {
+            perror("malloc");
+            keep = false;
+        }
+    }
+
+    if (out->tmp_path != NULL) {
+        if (keep && rename(out->tmp_path, out->target) < 0) {
+            perror(out->target);
+            keep = false;
+        }
+        if (!keep) {
+            unlink(out->tmp_path);
+        }
+    }
+
+    close(out->fd);
+    free(out->target);
+    free(out->tmp_path);
+    memset(out, 0, sizeof(*out));
+    out->fd = -1;
+}
+
+void
+finish_atomic_output(pid_t pid, int wstatus)
+{
+    for (size_t i = 0; i < num_atomic_outs; i++) {
+        if (atomic_outs[i].pid == pid) {
+            commit_atomic_output(&atomic_outs[i],
+                                 WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0);
+            atomic_outs[i] = atomic_outs[--num_atomic_outs];
+            return;
+        }
+    }
+}
+
+void
+cmds_after_fork(void)
+{
+    // The coprocesses and pending '>!' outputs stay the parent's: drop our
+    // copies of their fds without stopping, linking or unlinking anything.
+    for (size_t i = 0; i < MAX_COPROCS; i++) {
+        if (coprocs[i].name != NULL) {
+            close(coprocs[i].to_fd);
+            close(coprocs[i].from_fd);
+            free(coprocs[i].name);
+            memset(&coprocs[i], 0, sizeof(coprocs[i]));
+        }
+    }
+    for (size_t i = 0; i < num_atomic_outs; i++) {
+        close(atomic_outs[i].fd);
+        free(atomic_outs[i].target);
+        free(atomic_outs[i].tmp_path);
+    }
+    free(atomic_outs);
+    atomic_outs = NULL;
+    num_atomic_outs = 0;
+}
+
+// Built-in detection and dispatch.
+int
 is_builtin(const char *name)
 {
     if (name == NULL) {
         return 0;
     }
-    return strcmp(name, "cd")    == 0 ||
-           strcmp(name, "pwd")   == 0 ||
-           strcmp(name, "which") == 0 ||
-           strcmp(name, "exit")  == 0 ||
-           strcmp(name, "die")   == 0;
+    // The built-in names are WORD_CD .. WORD_WAITFOR.
+    for (word_t w = WORD_CD; w <= WORD_WAITFOR; w++) {
+        if (is_word(name, w)) {
+            return 1;
+        }
+    }
+    return plugin_flags(name) != 0;
 }
 
 // Run a built-in in the parent process (for simple non-pipeline commands).
@@ -545,36 +1450,54 @@ run_builtin_parent(char *const argv[], int *status_out, exec_action_t *action_ou
 
     const char *cmd = argv[0];
 
-    if (strcmp(cmd, "cd") == 0) {
+    if (is_word(cmd, WORD_CD)) {
         int rc = builtin_cd(argv);
         if (status_out != NULL) {
             *status_out = rc;
         }
         return 0;
-    } else if (strcmp(cmd, "pwd") == 0) {
+    } else if (is_word(cmd, WORD_PWD)) {
         int rc = builtin_pwd(argv);
         if (status_out != NULL) {
             *status_out = rc;
         }
         return 0;
-    } else if (strcmp(cmd, "which") == 0) {
+    } else if (is_word(cmd, WORD_WHICH)) {
         int rc = builtin_which(argv);
         if (status_out != NULL) {
             *status_out = rc;
         }
         return 0;
-    } else if (strcmp(cmd, "exit") == 0) {
+    } else if (is_word(cmd, WORD_EXIT)) {
         int rc = builtin_exit(argv, action_out);
         if (status_out != NULL) {
             *status_out = rc;
         }
         return 0;
-    } else if (strcmp(cmd, "die") == 0) {
+    } else if (is_word(cmd, WORD_DIE)) {
         int rc = builtin_die(argv, action_out);
         if (status_out != NULL) {
             *status_out = rc;
         }
         return 0;
+    } else if (is_word(cmd, WORD_JOBCLASS)) {
+        int rc = builtin_jobclass(argv);
+        if (status_out != NULL) {
+            *status_out = rc;
+        }
+        return 0;
+    } else if (is_word(cmd, WORD_COPROC)) {
+        int rc = builtin_coproc(argv);
+        if (status_out != NULL) {
+            *status_out = rc;
+        }
+        return 0;
+    } else if (is_word(cmd, WORD_WAITFOR)) {
+        int rc = builtin_waitfor(argv);
+        if (status_out != NULL) {
+            *status_out = rc;
+        }
+        return 0;
     }
 
     // Should not reach here if is_builtin() was correct.
@@ -593,24 +1516,60 @@ run_builtin_child(char *const argv[])
 
     const char *cmd = argv[0];
 
-    if (strcmp(cmd, "cd") == 0) {
-        // cd in a child doesn't affect the parent shell.
+    if (is_word(cmd, WORD_CD) || is_word(cmd, WORD_JOBCLASS)) {
+        // cd / jobclass in a child don't affect the parent shell.
         return 0;
-    } else if (strcmp(cmd, "pwd") == 0) {
+    } else if (is_word(cmd, WORD_PWD)) {
         return builtin_pwd(argv);
-    } else if (strcmp(cmd, "which") == 0) {
+    } else if (is_word(cmd, WORD_WHICH)) {
         return builtin_which(argv);
-    } else if (strcmp(cmd, "exit") == 0) {
+    } else if (is_word(cmd, WORD_EXIT)) {
         exec_action_t dummy = EXEC_CONTINUE;
         return builtin_exit(argv, &dummy);
-    } else if (strcmp(cmd, "die") == 0) {
+    } else if (is_word(cmd, WORD_DIE)) {
         exec_action_t dummy = EXEC_CONTINUE;
         return builtin_die(argv, &dummy);
+    } else if (is_word(cmd, WORD_COPROC)) {
+        // A coprocess started from a child would die with the child's view
+        // of the table; it only makes sense in the shell itself.
+        fprintf(stderr, "coproc: cannot be used in a pipeline\n");
+        return 1;
+    } else if (is_word(cmd, WORD_WAITFOR)) {
+        return builtin_waitfor(argv);
+    } else if (plugin_flags(cmd) & (MYSH_BUILTIN_CHILD | MYSH_BUILTIN_THREAD)) {
+        fflush(stdout);
+        return plugin_run(argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+    } else if (plugin_flags(cmd) != 0) {
+        fprintf(stderr, "%s: cannot be used in a pipeline\n", cmd);
+        return 1;
     }
 
     return 0;
 }
 
+// A plugin builtin in the shell itself, with the job's redirections already
+// on stdin/stdout. Without '<' in batch mode it gets /dev/null, as a child
+// would, so it can't read the script the shell is reading.
+static int
+run_parent_plugin(const job_t *job, bool input_is_tty)
+{
+    int in_fd = STDIN_FILENO;
+    if (job->infile == NULL && !input_is_tty) {
+        in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) {
+            perror("/dev/null");
+            return 1;
+        }
+    }
+
+    fflush(stdout);
+    int status = plugin_run(job->argvv[0], in_fd, STDOUT_FILENO, STDERR_FILENO);
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    return status;
+}
+
 
 // Built-in implementations.
 
@@ -721,13 +1680,330 @@ builtin_die(char *const argv[], exec_action_t *action_out)
     return 1;
 }
 
+static int
+builtin_jobclass(char *const argv[])
+{
+    // jobclass <io|cpu|mem> <limit> [command...]
+    // A limit of 0 removes the cap; each command name given is tagged with
+    // the class when it appears in a job without an explicit @class.
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+
+    if (argc < 3) {
+        fprintf(stderr, "jobclass: usage: jobclass CLASS LIMIT [COMMAND...]\n");
+        return 1;
+    }
+
+    job_class_t jclass;
+    if (sched_class_from_name(argv[1], &jclass) < 0) {
+        fprintf(stderr, "jobclass: unknown class '%s'\n", argv[1]);
+        return 1;
+    }
+
+    char *end = NULL;
+    unsigned long limit = strtoul(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0') {
+        fprintf(stderr, "jobclass: invalid limit '%s'\n", argv[2]);
+        return 1;
+    }
+
+    sched_set_class_limit(jclass, (size_t)limit);
+    for (int i = 3; i < argc; i++) {
+        if (sched_add_class_rule(jclass, argv[i]) < 0) {
+            fprintf(stderr, "jobclass: too many rules\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Milliseconds left until deadline, for poll(); -1 (forever) if no deadline.
+static int
+ms_until(const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ms = (double)(deadline->tv_sec - now.tv_sec) * 1e3 +
+                (double)(deadline->tv_nsec - now.tv_nsec) / 1e6;
+    if (ms <= 0.0) {
+        return 0;
+    }
+    return ms > (double)INT_MAX ? INT_MAX : (int)ceil(ms);
+}
+
+static int
+builtin_waitfor(char *const argv[])
+{
+    // waitfor PATH [TIMEOUT]
+    // Succeeds once PATH exists and is complete: it is already there, is
+    // renamed into place, or is created and then closed after writing.
+    // Fails after TIMEOUT seconds (fractions allowed); default is forever.
+    if (argv[1] == NULL || (argv[2] != NULL && argv[3] != NULL)) {
+        fprintf(stderr, "waitfor: usage: waitfor PATH [TIMEOUT]\n");
+        return 1;
+    }
+    const char *path = argv[1];
+
+    struct timespec deadline;
+    struct timespec *until = NULL;
+    if (argv[2] != NULL) {
+        char *end = NULL;
+        double secs = strtod(argv[2], &end);
+        if (end == argv[2] || *end != '\0' || !(secs >= 0.0) || secs > 1e9) {
+            fprintf(stderr, "waitfor: invalid timeout '%s'\n", argv[2]);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)secs;
+        deadline.tv_nsec += (long)((secs - floor(secs)) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        until = &deadline;
+    }
+
+    // Watch the directory the path will appear in.
+    char *dir_copy = my_strdup(path);
+    char *base_copy = my_strdup(path);
+    if (dir_copy == NULL || base_copy == NULL) {
+        free(dir_copy);
+        free(base_copy);
+        perror("waitfor");
+        return 1;
+    }
+    const char *dir = dirname(dir_copy);
+    const char *name = basename(base_copy);
+
+    int status = 1;
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (ifd < 0) {
+        perror("waitfor: inotify_init1");
+        goto out;
+    }
+    if (inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        fprintf(stderr, "waitfor: %s: %s\n", dir, strerror(errno));
+        goto out;
+    }
+
+    // Checked after the watch is in place, so nothing can slip in between.
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        status = 0;
+        goto out;
+    }
+
+    // Once created, a new regular file is only complete at its
+    // close-after-write. Anything else that can be created (a directory,
+    // symlink, FIFO, device or a hard link to an existing file) is never
+    // written through that name, so it is complete as soon as it appears.
+    bool created = false;
+    while (status != 0) {
+        struct pollfd pfd = { ifd, POLLIN, 0 };
+        int rc = poll(&pfd, 1, ms_until(until));
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            if (rc < 0) {
+                perror("waitfor: poll");
+            }
+            break;  // timed out
+        }
+
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + len;) {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                p += sizeof(*ev) + ev->len;
+                if (ev->len == 0 || strcmp(ev->name, name) != 0) {
+                    continue;
+                }
+                if ((ev->mask & IN_MOVED_TO) ||
+                    (ev->mask & IN_CLOSE_WRITE && (created || stat(path, &st) == 0))) {
+                    status = 0;
+                } else if (ev->mask & IN_CREATE) {
+                    if (lstat(path, &st) != 0) {
+                        continue;  // already gone again
+                    }
+                    if (S_ISREG(st.st_mode) && st.st_nlink == 1) {
+                        created = true;
+                    } else {
+                        status = 0;
+                    }
+                }
+            }
+        }
+    }
+
+out:
+    if (ifd >= 0) {
+        close(ifd);
+    }
+    free(dir_copy);
+    free(base_copy);
+    return status;
+}
+
+static coproc_t *
+find_coproc(const char *name)
+{
+    for (size_t i = 0; i < MAX_COPROCS; i++) {
+        if (coprocs[i].name != NULL && strcmp(coprocs[i].name, name) == 0) {
+            return &coprocs[i];
+        }
+    }
+    return NULL;
+}
+
+bool
+is_coproc_pid(pid_t pid)
+{
+    for (size_t i = 0; i < MAX_COPROCS; i++) {
+        if (coprocs[i].name != NULL && !coprocs[i].reaped && coprocs[i].pid == pid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+coproc_reaped(pid_t pid, int wstatus)
+{
+    for (size_t i = 0; i < MAX_COPROCS; i++) {
+        if (coprocs[i].name != NULL && !coprocs[i].reaped && coprocs[i].pid == pid) {
+            coprocs[i].reaped  = true;
+            coprocs[i].wstatus = wstatus;
+            return;
+        }
+    }
+}
+
+// Close the shell's ends of a coprocess and wait for it to exit, unless
+// the scheduler already did.
+static int
+stop_coproc(coproc_t *cp)
+{
+    close(cp->to_fd);
+    close(cp->from_fd);
+
+    int status = 1;
+    int wstatus = cp->wstatus;
+    if (!cp->reaped && waitpid(cp->pid, &wstatus, 0) < 0) {
+        perror("waitpid");
+    } else {
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+    }
+
+    free(cp->name);
+    memset(cp, 0, sizeof(*cp));
+    return status;
+}
+
+static int
+builtin_coproc(char *const argv[])
+{
+    // coproc NAME COMMAND [ARGS...]   start a coprocess
+    // coproc NAME                     close its stdin and wait for it
+    if (argv[1] == NULL) {
+        fprintf(stderr, "coproc: usage: coproc NAME [COMMAND [ARGS...]]\n");
+        return 1;
+    }
+
+    const char *name = argv[1];
+    coproc_t *cp = find_coproc(name);
+
+    if (argv[2] == NULL) {
+        if (cp == NULL) {
+            fprintf(stderr, "coproc: %s: no such coprocess\n", name);
+            return 1;
+        }
+        return stop_coproc(cp);
+    }
+
+    if (cp != NULL) {
+        fprintf(stderr, "coproc: %s: already running\n", name);
+        return 1;
+    }
+    for (size_t i = 0; i < MAX_COPROCS && cp == NULL; i++) {
+        if (coprocs[i].name == NULL) {
+            cp = &coprocs[i];
+        }
+    }
+    if (cp == NULL) {
+        fprintf(stderr, "coproc: too many coprocesses\n");
+        return 1;
+    }
+
+    char *path = resolve_program_path(argv[2]);
+    if (path == NULL) {
+        fprintf(stderr, "%s: command not found\n", argv[2]);
+        return 127;
+    }
+
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) < 0) {
+        perror("pipe");
+        free(path);
+        return 1;
+    }
+    if (pipe2(from_child, O_CLOEXEC) < 0) {
+        perror("pipe");
+        close(to_child[0]);
+        close(to_child[1]);
+        free(path);
+        return 1;
+    }
+
+    char *cp_name = my_strdup(name);
+    pid_t pid = (cp_name != NULL) ? fork() : -1;
+    if (pid < 0) {
+        perror("fork");
+        free(cp_name);
+        free(path);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        return 1;
+    }
+
+    if (pid == 0) {
+        if (dup2(to_child[0], STDIN_FILENO) < 0 ||
+            dup2(from_child[1], STDOUT_FILENO) < 0) {
+            perror("dup2");
+            _exit(1);
+        }
+        execv(path, argv + 2);
+        perror("execv");
+        _exit(127);
+    }
+
+    free(path);
+    close(to_child[0]);
+    close(from_child[1]);
+
+    cp->name    = cp_name;
+    cp->pid     = pid;
+    cp->to_fd   = to_child[1];
+    cp->from_fd = from_child[0];
+    return 0;
+}
+
 
 // Program path resolution
 // Implements the "bare names" rules from the spec:
 //   - If cmd_name contains '/', treat it as a path directly.
 //   - Otherwise, if it's a built-in, do not search the filesystem.
 //   - Else search /usr/local/bin, /usr/bin, /bin in that order using access().
-static char *
+char *
 resolve_program_path(const char *cmd_name)
 {
     if (cmd_name == NULL) {
@@ -770,3 +2046,64 @@ resolve_program_path(const char *cmd_name)
 
     return NULL; // not found
 }
+
+// True if the last component of path is name.
+static bool
+has_basename(const char *path, const char *name)
+{
+    const char *slash = strrchr(path, '/');
+    return strcmp(slash != NULL ? slash + 1 : path, name) == 0;
+}
+
+// Nested scripts
+// A program that is itself a mysh script would cost another fork + exec
+// of mysh and a cold start. is_nested_script() recognizes one: an
+// executable regular file whose "#!" line is ".../mysh" or ".../env mysh"
+// with nothing after it, or one named *.mysh with no "#!" line at all.
+// It must be run with no arguments, since mysh would refuse them.
+bool
+is_nested_script(const char *path, char *const argv[])
+{
+    if (argv[1] != NULL || access(path, X_OK) != 0) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    char head[SHEBANG_MAX];
+    ssize_t n = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        n = read(fd, head, sizeof(head) - 1);
+    }
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+    head[n] = '\0';
+
+    if (n < 2 || head[0] != '#' || head[1] != '!') {
+        size_t len = strlen(path);
+        size_t suffix = strlen(SCRIPT_SUFFIX);
+        return len > suffix && strcmp(path + len - suffix, SCRIPT_SUFFIX) == 0;
+    }
+
+    char *eol = strchr(head, '\n');
+    if (eol == NULL) {
+        return false;  // a "#!" line this long is not one of ours
+    }
+    *eol = '\0';
+    char *words[3];
+    size_t num_words = 0;
+    char *save = NULL;
+    for (char *w = strtok_r(head + 2, " \t\r", &save); w != NULL && num_words < 3;
+         w = strtok_r(NULL, " \t\r", &save)) {
+        words[num_words++] = w;
+    }
+    if (num_words == 1) {
+        return has_basename(words[0], "mysh");
+    }
+    return num_words == 2 && has_basename(words[0], "env") &&
+           strcmp(words[1], "mysh") == 0;
+}
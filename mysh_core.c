@@ -7,10 +7,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdio_ext.h>
 
 /*
  * Core shell logic:
- *   - tokenization and parsing (simple_tokenize, parse_line)
+ *   - tokenization and parsing (simple_tokenize, parse_line, parse_chain)
  *   - read/execute loop (read_and_execute_loop)
  *   - top-level process setup (main)
  */
@@ -21,25 +23,14 @@ int last_exit_status = 0;
 int shell_exit_status = EXIT_SUCCESS; 
 /* True once we have seen at least one syntactically valid (non-empty) command. */
 static bool have_seen_command = false;
+/* True while the job that sets last_exit_status is still running concurrently. */
+static bool last_status_pending = false;
 
 /* Print a consistent error message prefix for mysh. */
 void print_mysh_error(const char* context, const char* message) {
     fprintf(stderr, "mysh: %s: %s\n", context, message);
 }
 
-/* strdup with error reporting used during parsing. */
-static char* safe_strdup(const char* s) {
-    if (!s) return NULL;
-    char* d = (char*)malloc(strlen(s) + 1);
-    if (d == NULL) {
-        print_mysh_error("malloc", "failed to duplicate string");
-        // Caller treats NULL as a parse error path.
-        return NULL; 
-    }
-    strcpy(d, s);
-    return d;
-}
-
 /* Free all dynamically allocated memory in a job_t and reset it. */
 void free_job(job_t *job) {
     if (!job) return;
@@ -49,24 +40,48 @@ void free_job(job_t *job) {
             if (job->argvv[i]) {
                 char **argv = (char**)job->argvv[i];
                 for (size_t j = 0; argv[j] != NULL; j++) {
-                    free(argv[j]);
+                    intern_free(argv[j]);
                 }
                 free(job->argvv[i]);
             }
         }
         free(job->argvv);
     }
-    free(job->infile);
-    free(job->outfile);
+    intern_free(job->infile);
+    intern_free(job->outfile);
+
+    if (job->inputs) {
+        for (size_t i = 0; job->inputs[i] != NULL; i++) {
+            intern_free(job->inputs[i]);
+        }
+        free(job->inputs);
+    }
+
+    if (job->paths) {
+        for (size_t i = 0; i < job->num_procs; i++) {
+            free(job->paths[i]);
+        }
+        free(job->paths);
+    }
     
     memset(job, 0, sizeof(job_t));
 }
 
+/* Intern a token, reporting allocation failure as a parse error. */
+static char* intern_token(const char* s) {
+    char* t = intern(s);
+    if (t == NULL) {
+        print_mysh_error("malloc", "failed to store token");
+    }
+    return t;
+}
+
 /*
  * Tokenize a line into MAX_TOKENS tokens.
  * - Whitespace separates tokens.
- * - '|', '<', '>' are always single-character tokens.
+ * - '|', '<', '>' are always single-character tokens, except ">!".
  * - '#' starts a comment: the rest of the line is ignored.
+ * Tokens are interned (see mysh_intern.c); release them with intern_free().
  */
 static int simple_tokenize(char* line, char* tokens[MAX_TOKENS]) {
     int t = 0;
@@ -81,10 +96,14 @@ static int simple_tokenize(char* line, char* tokens[MAX_TOKENS]) {
             break;
         }
 
-        if (*p == '|' || *p == '<' || *p == '>') {
+        if (*p == '>' && p[1] == '!') {
+            // Atomic output redirection
+            tokens[t++] = (char*)intern_word(WORD_OUT_ATOMIC);
+            p += 2;
+        } else if (*p == '|' || *p == '<' || *p == '>') {
             // Special character token
-            tokens[t++] = safe_strdup((char[]){ *p, '\0' });
-            if (!tokens[t-1]) return -1;
+            tokens[t++] = (char*)intern_word(*p == '|' ? WORD_PIPE :
+                                             *p == '<' ? WORD_IN : WORD_OUT);
             p++;
         } else if (isspace((unsigned char)*p)) {
             p++;
@@ -98,9 +117,12 @@ static int simple_tokenize(char* line, char* tokens[MAX_TOKENS]) {
             }
             char temp = *p;
             *p = '\0';
-            tokens[t++] = safe_strdup(start);
-            if (!tokens[t-1]) return -1;
+            tokens[t++] = intern_token(start);
             *p = temp;
+            if (!tokens[t-1]) {
+                for (int k = 0; k < t - 1; k++) intern_free(tokens[k]);
+                return -1;
+            }
         }
         // Skip internal whitespace before next token
         while (*p && isspace((unsigned char)*p)) p++;
@@ -136,27 +158,106 @@ int parse_line(char *line, job_t *job) {
 
     // Initialize job
     job->cond      = COND_NONE;
+    job->jclass    = JOB_CLASS_NONE;
+    job->inputs    = NULL;
+    job->bench_runs   = 0;
+    job->bench_warmup = 0;
+    job->perfstat  = false;
+    job->atomic_out = false;
+    job->paths     = NULL;
     job->infile    = NULL;
     job->outfile   = NULL;
     job->num_procs = 0;
     job->argvv     = NULL;
 
     // Check for leading conditional ("and"/"or").
-    if (strcmp(tokens[0], "and") == 0) {
+    if (is_word(tokens[0], WORD_AND)) {
         job->cond = COND_AND;
         current_token++;
-    } else if (strcmp(tokens[0], "or") == 0) {
+    } else if (is_word(tokens[0], WORD_OR)) {
         job->cond = COND_OR;
         current_token++;
     }
 
-    // If only a conditional token remains, it's a syntax error.
-    if (current_token >= token_count) {
-        if (job->cond != COND_NONE) {
-            print_mysh_error("syntax error", "conditional must be followed by a command");
+    // Optional benchmark prefix: "bench [-n N] [-w W]" (see run_bench()).
+    if (current_token < token_count && is_word(tokens[current_token], WORD_BENCH)) {
+        job->bench_runs   = BENCH_DEFAULT_RUNS;
+        job->bench_warmup = BENCH_DEFAULT_WARMUP;
+        current_token++;
+
+        while (current_token + 1 < token_count &&
+               (strcmp(tokens[current_token], "-n") == 0 ||
+                strcmp(tokens[current_token], "-w") == 0)) {
+            char *end = NULL;
+            long value = strtol(tokens[current_token + 1], &end, 10);
+            if (*end != '\0' || value < 0 ||
+                (value == 0 && tokens[current_token][1] == 'n')) {
+                print_mysh_error("syntax error", "bench: invalid count");
+                goto parse_error;
+            }
+            if (tokens[current_token][1] == 'n') {
+                job->bench_runs = (size_t)value;
+            } else {
+                job->bench_warmup = (size_t)value;
+            }
+            current_token += 2;
+        }
+    }
+
+    // Optional counters prefix: "perfstat" (see run_perfstat()).
+    if (current_token < token_count && is_word(tokens[current_token], WORD_PERFSTAT)) {
+        job->perfstat = true;
+        current_token++;
+    }
+
+    // Optional annotations: a resource class ("@io", "@cpu", "@mem") and
+    // any number of declared inputs ("@in=PATH", used by --watch).
+    size_t num_inputs = 0;
+    while (current_token < token_count && tokens[current_token][0] == '@') {
+        const char *annotation = tokens[current_token] + 1;
+
+        if (strncmp(annotation, "in=", 3) == 0 && annotation[3] != '\0') {
+            if (job->inputs == NULL) {
+                job->inputs = (char **)calloc(MAX_ARGS, sizeof(char *));
+                if (!job->inputs) {
+                    print_mysh_error("malloc", "failed to allocate input list");
+                    goto parse_error;
+                }
+            }
+            if (num_inputs >= MAX_ARGS - 1) {
+                print_mysh_error("syntax error", "too many declared inputs");
+                goto parse_error;
+            }
+            job->inputs[num_inputs] = intern_token(annotation + 3);
+            if (!job->inputs[num_inputs]) {
+                goto parse_error;
+            }
+            num_inputs++;
+        } else if (sched_class_from_name(annotation, &job->jclass) < 0) {
+            print_mysh_error("syntax error", "unknown job annotation");
             goto parse_error;
         }
-        goto parse_cleanup_success;
+        current_token++;
+    }
+
+    // If only a conditional / prefix remains, it's a syntax error; name
+    // the prefix closest to the missing command.
+    if (current_token >= token_count) {
+        char message[128];
+        if (job->jclass != JOB_CLASS_NONE || job->inputs != NULL) {
+            snprintf(message, sizeof(message), "'%.64s' must be followed by a command",
+                     tokens[current_token - 1]);
+        } else if (job->perfstat) {
+            snprintf(message, sizeof(message), "'perfstat' must be followed by a command");
+        } else if (job->bench_runs != 0) {
+            snprintf(message, sizeof(message), "'bench' must be followed by a command");
+        } else if (job->cond != COND_NONE) {
+            snprintf(message, sizeof(message), "conditional must be followed by a command");
+        } else {
+            goto parse_cleanup_success;
+        }
+        print_mysh_error("syntax error", message);
+        goto parse_error;
     }
 
     // Initialize argument array for the first command
@@ -172,7 +273,7 @@ int parse_line(char *line, job_t *job) {
         char *token = tokens[current_token];
 
         // Handle pipeline separators
-        if (strcmp(token, "|") == 0) {
+        if (is_word(token, WORD_PIPE)) {
             if (current_argc == 0) {
                 print_mysh_error("syntax error", "empty command before pipe");
                 goto parse_error;
@@ -198,34 +299,32 @@ int parse_line(char *line, job_t *job) {
             continue;
         }
 
-        // Handle redirection tokens: "<" or ">"
-        if (strcmp(token, "<") == 0 || strcmp(token, ">") == 0) {
+        // Handle redirection tokens: "<", ">" or ">!" (atomic)
+        if (is_word(token, WORD_IN) || is_word(token, WORD_OUT) ||
+            is_word(token, WORD_OUT_ATOMIC)) {
             if (current_token + 1 >= token_count) {
                 print_mysh_error("syntax error", "redirection requires a filename");
                 goto parse_error;
             }
 
+            // The job takes over the (interned) filename token.
             char *filename = tokens[current_token + 1];
 
-            if (strcmp(token, "<") == 0) {
+            if (is_word(token, WORD_IN)) {
                 if (job->infile) {
                     print_mysh_error("syntax error", "multiple input redirections");
                     goto parse_error;
                 }
-                job->infile = safe_strdup(filename);
-                if (!job->infile) {
-                    goto parse_error;
-                }
-            } else { // ">"
+                job->infile = filename;
+            } else { // ">" or ">!"
                 if (job->outfile) {
                     print_mysh_error("syntax error", "multiple output redirections");
                     goto parse_error;
                 }
-                job->outfile = safe_strdup(filename);
-                if (!job->outfile) {
-                    goto parse_error;
-                }
+                job->atomic_out = is_word(token, WORD_OUT_ATOMIC);
+                job->outfile = filename;
             }
+            tokens[current_token + 1] = NULL;
 
             current_token += 2;  // skip redirection token and filename
             continue;
@@ -236,7 +335,7 @@ int parse_line(char *line, job_t *job) {
         // That corresponds to a subcommand (current_cmd_idx > 0) whose
         // first token (current_argc == 0) is "and" or "or".
         if (current_argc == 0 && current_cmd_idx > 0 &&
-            (strcmp(token, "and") == 0 || strcmp(token, "or") == 0)) {
+            (is_word(token, WORD_AND) || is_word(token, WORD_OR))) {
             print_mysh_error("syntax error", "conditional may not appear after a pipe");
             goto parse_error;
         }
@@ -246,10 +345,9 @@ int parse_line(char *line, job_t *job) {
             goto parse_error;
         }
 
-        temp_argvs[current_cmd_idx][current_argc] = safe_strdup(token);
-        if (!temp_argvs[current_cmd_idx][current_argc]) {
-            goto parse_error;
-        }
+        // argv shares the interned token rather than copying it.
+        temp_argvs[current_cmd_idx][current_argc] = token;
+        tokens[current_token] = NULL;
         current_argc++;
         temp_argvs[current_cmd_idx][current_argc] = NULL;
 
@@ -280,7 +378,7 @@ int parse_line(char *line, job_t *job) {
 
 parse_cleanup_success:
     for (int i = 0; i < token_count; i++) {
-        free(tokens[i]);
+        intern_free(tokens[i]);
     }
     return 1;
 
@@ -291,25 +389,323 @@ parse_error:
             char **argv = temp_argvs[i];
             for (int j = 0; j < MAX_ARGS; j++) {
                 if (argv[j] == NULL) break;
-                free(argv[j]);
+                intern_free(argv[j]);
             }
             free(temp_argvs[i]);
         }
     }
 
-    free(job->infile);
-    free(job->outfile);
+    intern_free(job->infile);
+    intern_free(job->outfile);
     job->infile  = NULL;
     job->outfile = NULL;
 
+    if (job->inputs) {
+        for (size_t i = 0; job->inputs[i] != NULL; i++) {
+            intern_free(job->inputs[i]);
+        }
+        free(job->inputs);
+        job->inputs = NULL;
+    }
+
     for (int i = 0; i < token_count; i++) {
-        free(tokens[i]);
+        intern_free(tokens[i]);
     }
 
     memset(job, 0, sizeof(job_t));
     return -1;
 }
 
+/* Free the jobs of a chain_t and reset it. */
+void free_chain(chain_t *chain) {
+    if (!chain) return;
+    for (size_t i = 0; chain->jobs && i < chain->num_jobs; i++) {
+        free_job(&chain->jobs[i]);
+    }
+    free(chain->jobs);
+    free(chain->texts);
+    memset(chain, 0, sizeof(chain_t));
+}
+
+/* True if a '#' at p would start a token, i.e. begin a comment. */
+static bool starts_comment(const char *line, const char *p) {
+    return *p == '#' &&
+           (p == line || p[-1] == '\0' || isspace((unsigned char)p[-1]) ||
+            strchr("|<>;&", p[-1]) != NULL);
+}
+
+/*
+ * Parse a line of jobs joined by ";", "&&" and "||" into a chain_t.
+ * There is no quoting, so the operators are found in the raw text and
+ * each part between them goes through parse_line() on its own.
+ *
+ * Returns 1 on success, 0 for an empty / comment-only line, -1 on error.
+ */
+int parse_chain(char *line, chain_t *chain) {
+    char *texts[MAX_CHAIN_JOBS];
+    condition_t ops[MAX_CHAIN_JOBS];  // operator before each part
+    size_t n = 0;
+    condition_t op = COND_NONE;
+    char *start = line;
+
+    memset(chain, 0, sizeof(chain_t));
+
+    // Split at the operators, stopping at a comment.
+    for (char *p = line; ; p++) {
+        size_t op_len = 0;
+        condition_t next = COND_NONE;
+        bool at_end = (*p == '\0' || starts_comment(line, p));
+
+        if (*p == ';') {
+            op_len = 1;
+        } else if (p[0] == '&' && p[1] == '&') {
+            op_len = 2;
+            next = COND_AND;
+        } else if (p[0] == '|' && p[1] == '|') {
+            op_len = 2;
+            next = COND_OR;
+        }
+        if (!at_end && op_len == 0) {
+            continue;
+        }
+
+        if (n >= MAX_CHAIN_JOBS) {
+            print_mysh_error("syntax error", "too many jobs on one line");
+            return -1;
+        }
+        *p = '\0';
+        while (isspace((unsigned char)*start)) start++;
+        texts[n] = start;
+        ops[n] = op;
+        n++;
+        if (at_end) {
+            break;
+        }
+        op = next;
+        p += op_len - 1;
+        start = p + 1;
+    }
+
+    // A trailing ";" leaves an empty last part; nothing else may be empty.
+    if (n > 1 && texts[n - 1][0] == '\0' && ops[n - 1] == COND_NONE) {
+        n--;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char *end = texts[i] + strlen(texts[i]);
+        while (end > texts[i] && isspace((unsigned char)end[-1])) *--end = '\0';
+    }
+    if (n == 1 && texts[0][0] == '\0') {
+        return 0;
+    }
+
+    chain->jobs  = (job_t *)calloc(n, sizeof(job_t));
+    chain->texts = (char **)malloc(n * sizeof(char *));
+    if (!chain->jobs || !chain->texts) {
+        print_mysh_error("malloc", "failed to allocate chain");
+        free_chain(chain);
+        return -1;
+    }
+    chain->num_jobs = n;
+
+    for (size_t i = 0; i < n; i++) {
+        job_t *job = &chain->jobs[i];
+        chain->texts[i] = texts[i];
+
+        if (texts[i][0] == '\0') {
+            print_mysh_error("syntax error", (i + 1 < n || ops[i] == COND_NONE)
+                             ? "empty job in chain"
+                             : "'&&' and '||' must be followed by a command");
+            free_chain(chain);
+            return -1;
+        }
+        if (parse_line(texts[i], job) <= 0) {
+            free_chain(chain);
+            return -1;
+        }
+        if (i > 0 && ops[i] != COND_NONE) {
+            if (job->cond != COND_NONE) {
+                print_mysh_error("syntax error",
+                                 "conditional may not follow '&&' or '||'");
+                free_chain(chain);
+                return -1;
+            }
+            job->cond = ops[i];
+        }
+    }
+    return 1;
+}
+
+/*
+ * Run (or skip, per its conditional) a job already parsed by parse_line().
+ * parse_status is parse_line()'s return value; the caller still owns and
+ * frees the job.
+ *
+ * Returns -1 to keep going, or the shell's exit code if the job asked the
+ * shell to terminate (exit / die).
+ *
+ * If cond_status is non-NULL and the job has a conditional, it receives the
+ * status the conditional was checked against.
+ *
+ * With the concurrent scheduler enabled, jobs without built-ins are started
+ * in the background and last_exit_status is left pending; it is resolved
+ * the next time a conditional needs it.
+ */
+int run_parsed_job(job_t *job, int parse_status, int *cond_status) {
+    flight_record(FLIGHT_PARSE, parse_status, (int32_t)job->num_procs);
+    if (parse_status == 0) {
+        return -1;
+    }
+    if (parse_status < 0) {
+        // Syntax error
+        last_exit_status = 1;
+        last_status_pending = false;
+        return -1;
+    }
+
+    // Enforce: conditionals should not occur in the first command.
+    if (!have_seen_command && job->cond != COND_NONE) {
+        print_mysh_error("syntax error",
+                         "conditional may not appear on first command");
+        last_exit_status = 1;
+        return -1;
+    }
+
+    // A conditional depends on the status of the job before it.
+    if (job->cond != COND_NONE && last_status_pending) {
+        last_exit_status = sched_wait_last();
+        last_status_pending = false;
+    }
+    if (job->cond != COND_NONE && cond_status != NULL) {
+        *cond_status = last_exit_status;
+    }
+
+    // Conditional logic check
+    if ((job->cond == COND_AND && last_exit_status != 0) ||
+        (job->cond == COND_OR && last_exit_status == 0)) {
+        // Skip execution; preserve last_exit_status.
+        flight_record(FLIGHT_COND_SKIP, job->cond, last_exit_status);
+    } else {
+        sched_wait_conflicts(job);
+        unsigned reaper_job = reaper_job_started(job);
+
+        if (sched_can_defer(job) && sched_submit(job, reading_from_terminal) == 0) {
+            last_status_pending = true;
+        } else {
+            sched_flush_output();
+
+            // Execute the job
+            int cmd_status = 0;
+            exec_action_t action =
+                execute_job(job, reading_from_terminal, &cmd_status);
+            last_exit_status = cmd_status;
+            last_status_pending = false;
+            reaper_job_finished(reaper_job);
+
+            // Check if a built-in command ('exit' or 'die') requested termination
+            if (action == EXEC_EXIT) {
+                sched_drain();
+                shell_exit_status = EXIT_SUCCESS;
+                return shell_exit_status;
+            } else if (action == EXEC_DIE) {
+                sched_drain();
+                shell_exit_status = EXIT_FAILURE;
+                flight_record(FLIGHT_DIE, shell_exit_status, 0);
+                flight_dump();
+                return shell_exit_status;
+            }
+        }
+    }
+
+    // We saw a syntactically valid command this line,
+    // whether or not it was executed due to conditionals.
+    have_seen_command = true;
+    return -1;
+}
+
+/*
+ * Set the status the next conditional is checked against, waiting for any
+ * concurrent jobs first. Used by --watch to resume a chain in the middle.
+ */
+void resume_with_status(int status) {
+    sched_drain();
+    last_exit_status = status;
+    last_status_pending = false;
+}
+
+/*
+ * Wait for jobs still running concurrently and return the final
+ * last_exit_status.
+ */
+int finish_pending_jobs(void) {
+    if (last_status_pending) {
+        last_exit_status = sched_drain();
+        last_status_pending = false;
+    } else {
+        sched_drain();
+    }
+    return last_exit_status;
+}
+
+/*
+ * Start a chain of several jobs on the scheduler as one unit, so the
+ * conditionals inside it don't hold up the lines after it. Returns false
+ * if the caller should run the jobs one by one instead.
+ */
+static bool submit_chain(chain_t *chain) {
+    job_t *first = &chain->jobs[0];
+
+    if (chain->num_jobs < 2 || !sched_can_defer_chain(chain)) {
+        return false;
+    }
+    if (first->cond != COND_NONE) {
+        if (!have_seen_command) {
+            return false;  // run_parsed_job() reports the syntax error
+        }
+        if (last_status_pending) {
+            last_exit_status = sched_wait_last();
+            last_status_pending = false;
+        }
+    }
+
+    for (size_t i = 0; i < chain->num_jobs; i++) {
+        sched_wait_conflicts(&chain->jobs[i]);
+    }
+    unsigned reaper_job = reaper_job_started(first);
+    if (sched_submit_chain(chain, last_exit_status, reading_from_terminal) < 0) {
+        reaper_job_finished(reaper_job);
+        return false;
+    }
+    flight_record(FLIGHT_PARSE, 1, (int32_t)chain->num_jobs);
+    last_status_pending = true;
+    have_seen_command = true;
+    return true;
+}
+
+/* Parse and run one line of input; see run_parsed_job(). */
+static int run_line(char *line) {
+    chain_t chain = (chain_t){0};
+    int parse_status = parse_chain(line, &chain);
+
+    if (parse_status <= 0) {
+        job_t empty = (job_t){0};
+        return run_parsed_job(&empty, parse_status, NULL);
+    }
+
+    int exit_code = -1;
+    progress_jobs(chain.num_jobs);
+    if (!submit_chain(&chain)) {
+        for (size_t i = 0; i < chain.num_jobs && exit_code < 0; i++) {
+            analyze_job_started();
+            exit_code = run_parsed_job(&chain.jobs[i], 1, NULL);
+            if (analyze_recording()) {
+                analyze_job_finished(&chain.jobs[i], chain.texts[i]);
+            }
+        }
+    }
+    free_chain(&chain);
+    return exit_code;
+}
+
 /*
  * Main read/execute loop.
  *
@@ -318,6 +714,7 @@ parse_error:
  * - At EOF, if there is a partial line without '\n', executes it as a final command.
  * - Tracks last_exit_status for conditionals and have_seen_command for
  *   "first command cannot use and/or".
+ * - Waits for any jobs still running concurrently before returning.
  */
 int read_and_execute_loop(int fd) {
     char buffer[INPUT_BUFFER_SIZE];
@@ -330,6 +727,9 @@ int read_and_execute_loop(int fd) {
             write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
         }
 
+        // Native stages of concurrent jobs keep running while we wait.
+        native_wait_input(fd);
+
         // Read more data into the buffer using read()
         ssize_t n = read(fd, buffer + bytes_read, INPUT_BUFFER_SIZE - bytes_read - 1);
 
@@ -352,51 +752,11 @@ int read_and_execute_loop(int fd) {
                 buffer[i] = '\0'; // Null-terminate the command
                 
                 // Process command (from line_start to i)
-                job_t job = (job_t){0};
-                int parse_status = parse_line(buffer + line_start, &job);
-
-                if (parse_status > 0) {
-
-                    // Enforce: conditionals should not occur in the first command.
-                    if (!have_seen_command && job.cond != COND_NONE) {
-                        print_mysh_error("syntax error",
-                                         "conditional may not appear on first command");
-                        last_exit_status = 1;
-                        free_job(&job);
-                    } else {
-                        // Conditional logic check
-                        if (job.cond == COND_AND && last_exit_status != 0) {
-                            // Skip execution; preserve last_exit_status.
-                        } else if (job.cond == COND_OR && last_exit_status == 0) {
-                            // Skip execution; preserve last_exit_status.
-                        } else {
-                            // Execute the job
-                            int cmd_status = 0;
-                            exec_action_t action =
-                                execute_job(&job, reading_from_terminal, &cmd_status);
-                            last_exit_status = cmd_status;
-
-                            // Check if a built-in command ('exit' or 'die') requested termination
-                            if (action == EXEC_EXIT) {
-                                free_job(&job);
-                                shell_exit_status = EXIT_SUCCESS;
-                                return shell_exit_status;
-                            } else if (action == EXEC_DIE) {
-                                free_job(&job);
-                                shell_exit_status = EXIT_FAILURE;
-                                return shell_exit_status;
-                            }
-                        }
-
-                        // We saw a syntactically valid command this line,
-                        // whether or not it was executed due to conditionals.
-                        have_seen_command = true;
-                        free_job(&job);
-                    }
-                } else if (parse_status == -1) {
-                    // Syntax error
-                    last_exit_status = 1;
+                int exit_code = run_line(buffer + line_start);
+                if (exit_code >= 0) {
+                    return exit_code;
                 }
+                progress_line(i + 1 - line_start);
                 
                 // Advance start index to the next line
                 line_start = i + 1;
@@ -416,48 +776,56 @@ int read_and_execute_loop(int fd) {
     if (bytes_read > 0) {
         buffer[bytes_read] = '\0';
 
-        job_t job = (job_t){0};
-        int parse_status = parse_line(buffer + line_start, &job);
+        int exit_code = run_line(buffer + line_start);
+        if (exit_code >= 0) {
+            return exit_code;
+        }
+        progress_line((size_t)bytes_read);
+    }
 
-        if (parse_status > 0) {
+    // Collect jobs still running concurrently.
+    finish_pending_jobs();
+    progress_end(true);
 
-            if (!have_seen_command && job.cond != COND_NONE) {
-                print_mysh_error("syntax error",
-                                 "conditional may not appear on first command");
-                last_exit_status = 1;
-                free_job(&job);
-            } else {
-                if (job.cond == COND_AND && last_exit_status != 0) {
-                    // Skip execution
-                } else if (job.cond == COND_OR && last_exit_status == 0) {
-                    // Skip execution
-                } else {
-                    int cmd_status = 0;
-                    exec_action_t action =
-                        execute_job(&job, reading_from_terminal, &cmd_status);
-                    last_exit_status = cmd_status;
-
-                    if (action == EXEC_EXIT) {
-                        free_job(&job);
-                        shell_exit_status = EXIT_SUCCESS;
-                        return shell_exit_status;
-                    } else if (action == EXEC_DIE) {
-                        free_job(&job);
-                        shell_exit_status = EXIT_FAILURE;
-                        return shell_exit_status;
-                    }
-                }
+    return shell_exit_status;
+}
 
-                have_seen_command = true;
-                free_job(&job);
-            }
-        } else if (parse_status == -1) {
-            // Syntax error on final line
-            last_exit_status = 1;
-        }
+/*
+ * Run a nested mysh script in this forked child instead of exec'ing mysh
+ * (see is_nested_script()). The child starts out as a copy of a busy
+ * shell, so first drop whatever belongs to the parent, then read the
+ * script exactly as "mysh path" would: serially and non-interactively.
+ */
+int run_nested_script(const char *path) {
+    /* Output the parent buffered is the parent's to write. */
+    __fpurge(stdout);
+    __fpurge(stderr);
+
+    native_after_fork();
+    sched_after_fork();
+    cmds_after_fork();
+    reaper_after_fork();
+    progress_after_fork();
+    analyze_set_recording(false);
+
+    is_interactive = false;
+    reading_from_terminal = false;
+    last_exit_status = 0;
+    shell_exit_status = EXIT_SUCCESS;
+    have_seen_command = false;
+    last_status_pending = false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        print_mysh_error(path, strerror(errno));
+        return EXIT_FAILURE;
     }
+    int status = read_and_execute_loop(fd);
+    close(fd);
 
-    return shell_exit_status;
+    fflush(stdout);
+    fflush(stderr);
+    return status;
 }
 
 
@@ -465,23 +833,168 @@ int read_and_execute_loop(int fd) {
 
 /*
  * Main entry point.
- * - Usage: mysh [scriptfile]
+ * - Usage: mysh [-j N|auto] [--adaptive] [--ordered] [--watch] [scriptfile]
  * - With no argument: read from stdin (interactive if stdin is a terminal).
  * - With one argument: read commands from the given file (always non-interactive).
+ * - -j N: run up to N independent jobs concurrently (see mysh_sched.c).
+ * - --adaptive: treat N as a ceiling and follow system pressure;
+ *   "-j auto" is --adaptive with a ceiling of two jobs per CPU.
+ * - --ordered: spool concurrent jobs' output and release it in script order.
+ * - --watch: keep re-running the jobs affected by changed inputs (mysh_watch.c).
+ * - --plugins DIR: load builtin plugins from DIR (default: $MYSH_PLUGIN_DIR).
+ * - --progress[=FD]: report progress and an ETA on stderr (or FD) (mysh_progress.c).
  */
 int main(int argc, char *argv[]) {
+    static const char usage[] =
+        "Usage: mysh [-j N|auto] [--adaptive] [--ordered] [--watch]\n"
+        "            [--subreaper[=kill]] [--plugins DIR] [--progress[=FD]]\n"
+        "            [scriptfile]\n"
+        "       mysh [-j N] --spool DIR\n"
+        "       mysh --analyze scriptfile | mysh --report [scriptfile]\n";
     int input_fd = STDIN_FILENO;
+    const char *script = NULL;
+    long max_jobs = 1;
+    bool adaptive = false;
+    bool ordered = false;
+    bool watch = false;
+    const char *spool = NULL;
+    bool analyze = false;
+    bool report = false;
+    int subreaper = 0;  /* 1: adopt and account, 2: also kill stragglers */
+    const char *plugins = NULL;
+    int progress_fd = -1;
+
+    flight_init();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                // Ceiling of two jobs per CPU; pressure decides the rest.
+                max_jobs = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+                adaptive = true;
+                continue;
+            }
+            char *end = NULL;
+            max_jobs = strtol(argv[i], &end, 10);
+            if (*end != '\0' || max_jobs < 1) {
+                print_mysh_error("-j", "expected a positive job count");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = true;
+        } else if (strcmp(argv[i], "--ordered") == 0) {
+            ordered = true;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            analyze = true;
+        } else if (strcmp(argv[i], "--report") == 0) {
+            report = true;
+        } else if (strcmp(argv[i], "--subreaper") == 0) {
+            subreaper = 1;
+        } else if (strcmp(argv[i], "--subreaper=kill") == 0) {
+            subreaper = 2;
+        } else if (strcmp(argv[i], "--spool") == 0 && i + 1 < argc) {
+            spool = argv[++i];
+        } else if (strcmp(argv[i], "--plugins") == 0 && i + 1 < argc) {
+            plugins = argv[++i];
+        } else if (strcmp(argv[i], "--progress") == 0) {
+            progress_fd = STDERR_FILENO;
+        } else if (strncmp(argv[i], "--progress=", 11) == 0) {
+            char *end = NULL;
+            long fd = strtol(argv[i] + 11, &end, 10);
+            if (end == argv[i] + 11 || *end != '\0' || fd < 0 || fd > INT_MAX ||
+                fcntl((int)fd, F_GETFD) < 0) {
+                print_mysh_error("--progress", "expected an open file descriptor");
+                return EXIT_FAILURE;
+            }
+            progress_fd = (int)fd;
+        } else if (script == NULL && argv[i][0] != '-') {
+            script = argv[i];
+        } else {
+            write(STDERR_FILENO, usage, strlen(usage));
+            return EXIT_FAILURE;
+        }
+    }
 
-    if (argc > 2) {
-        write(STDERR_FILENO, "Usage: mysh [scriptfile]\n", 25);
+    /* Plugins add builtins, so they must be in before any line is parsed.
+     * A bad --plugins directory is fatal; a stale $MYSH_PLUGIN_DIR is not. */
+    if (plugins != NULL) {
+        if (plugin_load_dir(plugins) < 0) {
+            return EXIT_FAILURE;
+        }
+    } else if ((plugins = getenv("MYSH_PLUGIN_DIR")) != NULL && plugins[0] != '\0') {
+        (void)plugin_load_dir(plugins);
+    }
+
+    if (progress_fd >= 0 && (watch || spool != NULL || analyze)) {
+        print_mysh_error("--progress", "only for a script read once");
+        return EXIT_FAILURE;
+    }
+    if (watch && script == NULL) {
+        print_mysh_error("--watch", "a script file is required");
         return EXIT_FAILURE;
     }
 
-    if (argc == 2) {
+    if (analyze) {
+        if (script == NULL) {
+            print_mysh_error("--analyze", "a script file is required");
+            return EXIT_FAILURE;
+        }
+        return analyze_script(script);
+    }
+    if (report) {
+        // Time every job on its own so the durations are exact; the report
+        // says what -j could gain.
+        max_jobs = 1;
+        adaptive = false;
+        analyze_set_recording(true);
+    }
+
+    if (subreaper && spool != NULL) {
+        print_mysh_error("--subreaper", "not supported with --spool");
+        return EXIT_FAILURE;
+    }
+    if (subreaper && reaper_init(subreaper == 2) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (spool != NULL) {
+        // Spool mode: -j limits job files, each of which runs serially.
+        if (script != NULL || watch) {
+            write(STDERR_FILENO, usage, strlen(usage));
+            return EXIT_FAILURE;
+        }
+        if (sched_init(1) < 0) {
+            return EXIT_FAILURE;
+        }
+        reading_from_terminal = false;
+        return spool_consume(spool, (size_t)max_jobs);
+    }
+
+    if (max_jobs < 2) {
+        max_jobs = adaptive ? 2 : 1;
+    }
+    if (sched_init((size_t)max_jobs) < 0) {
+        return EXIT_FAILURE;
+    }
+    sched_set_adaptive(adaptive);
+    if (sched_set_ordered(ordered) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (watch) {
+        // Watch mode: run the script, then re-run what its inputs affect.
+        reading_from_terminal = false;
+        return watch_script(script);
+    }
+
+    if (script != NULL) {
         // Batch mode: read from file
-        input_fd = open(argv[1], O_RDONLY);
+        input_fd = open(script, O_RDONLY);
         if (input_fd < 0) {
-            print_mysh_error(argv[1], strerror(errno));
+            print_mysh_error(script, strerror(errno));
             return EXIT_FAILURE;
         }
         reading_from_terminal = false;
@@ -497,8 +1010,14 @@ int main(int argc, char *argv[]) {
         write(STDOUT_FILENO, "Welcome to my shell!\n", 21);
     }
 
+    // Progress is for batch runs; a terminal has the prompt instead.
+    if (progress_fd >= 0 && !is_interactive) {
+        progress_init(progress_fd, input_fd, script);
+    }
+
     // Start the read/execute loop
     int exit_code = read_and_execute_loop(input_fd);
+    progress_end(false);  // after an exit or die; at EOF it already ran
     
     if (input_fd != STDIN_FILENO) {
         close(input_fd);
@@ -508,6 +1027,16 @@ int main(int argc, char *argv[]) {
         write(STDOUT_FILENO, "Exiting my shell.\n", 18);
     }
 
+    if (report) {
+        fflush(stdout);
+        analyze_report(stderr, true);
+        analyze_reset();
+    }
+    if (subreaper) {
+        fflush(stdout);
+        reaper_report(stderr);
+    }
+
     return exit_code;
 }
 #endif
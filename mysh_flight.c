@@ -0,0 +1,193 @@
+// Flight recorder for mysh.
+//
+// This file is responsible for:
+//   - Keeping the last FLIGHT_CAPACITY events (parse, spawn, reap, redirect
+//     open, conditional skip, die, fatal signal) in a fixed binary ring
+//   - Dumping the ring to a file on SIGUSR1, on 'die' and on a crash
+//
+// Recording is always on, so it has to be cheap: one relaxed fetch-add to
+// claim a slot, then relaxed stores of the fields. Each slot is a seqlock:
+// its seq is cleared before the fields are written and set again, with
+// release ordering, after them. The dump copies a slot only if it sees the
+// same nonzero seq before and after the copy, and writes seq 0 otherwise,
+// so a record that was being overwritten is dropped rather than shown torn.
+// There is no lock and no formatting; tools/flightdump decodes a dump
+// offline.
+//
+// flight_init() moves the ring into a MAP_SHARED mapping, so children keep
+// recording into the same ring until they exec (a redirect that fails in
+// the child still shows up). Before flight_init() -- e.g. in the test
+// binary -- a static ring is used instead.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+typedef struct {
+    uint64_t     next;   // sequence number of the next event
+    flight_rec_t recs[FLIGHT_CAPACITY];
+} flight_ring_t;
+
+static flight_ring_t  static_ring;
+static flight_ring_t *ring = &static_ring;
+
+// Precomputed so the signal handlers only call open/write/close.
+static char dump_path[256];
+static char dump_msg[300];
+static size_t dump_msg_len;
+
+void
+flight_record(flight_event_t event, int32_t a, int32_t b)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t seq = __atomic_fetch_add(&ring->next, 1, __ATOMIC_RELAXED);
+    flight_rec_t *rec = &ring->recs[seq & (FLIGHT_CAPACITY - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  // seq 0 is seen before any field
+    __atomic_store_n(&rec->ns, (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->pid, (int32_t)getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->event, (uint16_t)event, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->a, a, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->b, b, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy one slot; its seq is 0 in the copy if a write overlapped the copy.
+static void
+copy_rec(flight_rec_t *dst, const flight_rec_t *src)
+{
+    uint64_t before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+    dst->ns       = __atomic_load_n(&src->ns, __ATOMIC_RELAXED);
+    dst->pid      = __atomic_load_n(&src->pid, __ATOMIC_RELAXED);
+    dst->event    = __atomic_load_n(&src->event, __ATOMIC_RELAXED);
+    dst->reserved = 0;
+    dst->a        = __atomic_load_n(&src->a, __ATOMIC_RELAXED);
+    dst->b        = __atomic_load_n(&src->b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);  // the fields are read before seq again
+    uint64_t after = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+    dst->seq = before == after ? before : 0;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Write the header and ring to fd. Async-signal-safe.
+int
+flight_dump_fd(int fd)
+{
+    flight_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FLIGHT_MAGIC, sizeof(hdr.magic));
+    hdr.capacity = FLIGHT_CAPACITY;
+    hdr.rec_size = sizeof(flight_rec_t);
+    hdr.next     = __atomic_load_n(&ring->next, __ATOMIC_RELAXED);
+    hdr.pid      = (int32_t)getpid();
+
+    if (write_all(fd, &hdr, sizeof(hdr)) < 0) {
+        return -1;
+    }
+    // Copied through a small stack buffer, since other processes may be
+    // recording into the ring while it is dumped. FLIGHT_CAPACITY is a
+    // power of two, so a multiple of the batch.
+    flight_rec_t batch[64];
+    for (size_t i = 0; i < FLIGHT_CAPACITY; i += 64) {
+        for (size_t k = 0; k < 64; k++) {
+            copy_rec(&batch[k], &ring->recs[i + k]);
+        }
+        if (write_all(fd, batch, sizeof(batch)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Dump to the precomputed path. Async-signal-safe.
+void
+flight_dump(void)
+{
+    if (dump_path[0] == '\0') {
+        return;
+    }
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    int rc = flight_dump_fd(fd);
+    close(fd);
+    if (rc == 0) {
+        (void)!write(STDERR_FILENO, dump_msg, dump_msg_len);
+    }
+}
+
+static void
+on_dump_signal(int sig)
+{
+    flight_record(FLIGHT_SIGNAL, sig, 0);
+    flight_dump();
+}
+
+static void
+on_fatal_signal(int sig)
+{
+    // SA_RESETHAND restored the default action; re-raise to crash for real.
+    flight_record(FLIGHT_SIGNAL, sig, 1);
+    flight_dump();
+    raise(sig);
+}
+
+int
+flight_init(void)
+{
+    flight_ring_t *shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared != MAP_FAILED) {
+        memcpy(shared, ring, sizeof(*shared));
+        ring = shared;
+    }
+
+    const char *dir = getenv("MYSH_FLIGHT_DIR");
+    snprintf(dump_path, sizeof(dump_path), "%s/mysh-flight.%ld",
+             (dir != NULL && dir[0] != '\0') ? dir : "/tmp", (long)getpid());
+    int n = snprintf(dump_msg, sizeof(dump_msg),
+                     "mysh: flight recorder dumped to %s\n", dump_path);
+    dump_msg_len = (n > 0 && (size_t)n < sizeof(dump_msg)) ? (size_t)n : 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = on_dump_signal;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    static const int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sa.sa_handler = on_fatal_signal;
+    for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++) {
+        sigaction(fatal[i], &sa, NULL);
+    }
+    return 0;
+}
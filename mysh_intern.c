@@ -0,0 +1,218 @@
+// Token interning for mysh.
+//
+// This file is responsible for:
+//   - Keeping one shared copy of every distinct token the parser sees
+//   - Telling interned strings apart from ordinary heap strings
+//   - The shell's own words (and, or, |, the built-in names, ...), so
+//     parsed tokens can be recognized with a pointer compare
+//
+// Interned strings are bump-allocated from one INTERN_MAX_BYTES mapping
+// that is reserved up front (MAP_NORESERVE: pages cost memory only once
+// used) and never freed, so a parsed job's argv can point straight at
+// them and is_interned() is a single range check. An open-addressing hash
+// table finds existing copies. Once the mapping is full, intern() hands
+// out malloc'd copies instead; intern_free() frees those and leaves
+// interned ones alone.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define INTERN_MAX_BYTES   (16u << 20)
+#define INTERN_MIN_BUCKETS 1024
+
+typedef struct {
+    const char *str;   // NULL: empty bucket
+    uint32_t    hash;
+} intern_entry_t;
+
+static const char *const word_texts[NUM_WORDS] = {
+    [WORD_AND]        = "and",
+    [WORD_OR]         = "or",
+    [WORD_BENCH]      = "bench",
+    [WORD_PERFSTAT]   = "perfstat",
+    [WORD_PIPE]       = "|",
+    [WORD_IN]         = "<",
+    [WORD_OUT]        = ">",
+    [WORD_OUT_ATOMIC] = ">!",
+    [WORD_CD]         = "cd",
+    [WORD_PWD]        = "pwd",
+    [WORD_WHICH]      = "which",
+    [WORD_EXIT]       = "exit",
+    [WORD_DIE]        = "die",
+    [WORD_JOBCLASS]   = "jobclass",
+    [WORD_COPROC]     = "coproc",
+    [WORD_WAITFOR]    = "waitfor",
+};
+
+static char   *arena      = NULL;    // the mapping; NULL if unavailable
+static size_t  arena_used = 0;
+static bool    initialized = false;
+
+static intern_entry_t *buckets     = NULL;
+static size_t          num_buckets = 0;   // power of two
+static size_t          num_entries = 0;
+
+// The shell's words: interned copies, or word_texts if interning is off.
+static const char *words[NUM_WORDS];
+
+// FNV-1a; also returns the length so the caller needn't strlen() again.
+static uint32_t
+hash_string(const char *s, size_t *len)
+{
+    uint32_t h = 2166136261u;
+    const char *p = s;
+    for (; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    *len = (size_t)(p - s);
+    return h;
+}
+
+static int
+grow_buckets(void)
+{
+    size_t cap = num_buckets ? num_buckets * 2 : INTERN_MIN_BUCKETS;
+    intern_entry_t *grown = calloc(cap, sizeof(*grown));
+    if (grown == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        if (buckets[i].str == NULL) {
+            continue;
+        }
+        size_t b = buckets[i].hash & (cap - 1);
+        while (grown[b].str != NULL) {
+            b = (b + 1) & (cap - 1);
+        }
+        grown[b] = buckets[i];
+    }
+    free(buckets);
+    buckets = grown;
+    num_buckets = cap;
+    return 0;
+}
+
+static char *
+heap_copy(const char *s, size_t len)
+{
+    char *copy = malloc(len + 1);
+    if (copy != NULL) {
+        memcpy(copy, s, len + 1);
+    }
+    return copy;
+}
+
+static void
+intern_init(void)
+{
+    initialized = true;
+    void *p = mmap(NULL, INTERN_MAX_BYTES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p != MAP_FAILED && grow_buckets() == 0) {
+        arena = p;
+    } else if (p != MAP_FAILED) {
+        munmap(p, INTERN_MAX_BYTES);
+    }
+
+    for (size_t w = 0; w < NUM_WORDS; w++) {
+        words[w] = word_texts[w];
+        if (arena != NULL) {
+            char *copy = intern(word_texts[w]);
+            if (copy != NULL && is_interned(copy)) {
+                words[w] = copy;
+            }
+        }
+    }
+}
+
+char *
+intern(const char *s)
+{
+    if (!initialized) {
+        intern_init();
+    }
+
+    size_t len;
+    uint32_t hash = hash_string(s, &len);
+    if (arena == NULL) {
+        return heap_copy(s, len);
+    }
+
+    size_t b = hash & (num_buckets - 1);
+    while (buckets[b].str != NULL) {
+        if (buckets[b].hash == hash && strcmp(buckets[b].str, s) == 0) {
+            return (char *)buckets[b].str;
+        }
+        b = (b + 1) & (num_buckets - 1);
+    }
+
+    if (arena_used + len + 1 > INTERN_MAX_BYTES) {
+        return heap_copy(s, len);  // table full: an ordinary copy
+    }
+    if (2 * (num_entries + 1) > num_buckets) {
+        if (grow_buckets() < 0) {
+            return heap_copy(s, len);
+        }
+        b = hash & (num_buckets - 1);
+        while (buckets[b].str != NULL) {
+            b = (b + 1) & (num_buckets - 1);
+        }
+    }
+
+    char *copy = arena + arena_used;
+    memcpy(copy, s, len + 1);
+    arena_used += len + 1;
+    buckets[b].str  = copy;
+    buckets[b].hash = hash;
+    num_entries++;
+    return copy;
+}
+
+bool
+is_interned(const char *s)
+{
+    if (arena != NULL) {
+        return s != NULL && (uintptr_t)s - (uintptr_t)arena < arena_used;
+    }
+    // No table: only the shell's words are shared, as literals.
+    for (size_t w = 0; w < NUM_WORDS; w++) {
+        if (s == word_texts[w]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+intern_free(char *s)
+{
+    if (!is_interned(s)) {
+        free(s);
+    }
+}
+
+const char *
+intern_word(word_t w)
+{
+    if (!initialized) {
+        intern_init();
+    }
+    return words[w];
+}
+
+bool
+is_word(const char *s, word_t w)
+{
+    const char *word = intern_word(w);
+    if (s == word) {
+        return true;
+    }
+    // Two distinct interned strings always differ; others need a compare.
+    return s != NULL && !is_interned(s) && strcmp(s, word) == 0;
+}
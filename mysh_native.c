@@ -0,0 +1,1113 @@
+// Native pipeline stages for mysh.
+//
+// This file is responsible for:
+//   - Recognizing commands the shell can run itself inside a pipeline: the
+//     generators 'seq' and 'yes' (first stage) and the filters 'cat', 'wc'
+//     and 'head' (later stages)
+//   - Feeding generator output into the pipeline's first pipe without a fork
+//   - Running filter stages as coroutines multiplexed by one event loop
+//   - Waiting for stages run on threads (plugin builtins) in the same loop
+//
+// Generator output is handed to the pipe with vmsplice(), so the kernel
+// references our pages instead of copying them. Pages given to vmsplice()
+// must not change until the reader has consumed them:
+//   - 'yes' builds one buffer of whole lines and splices it over and over;
+//     its contents never change.
+//   - 'seq' formats into an mmap()ed chunk and unmaps it right after
+//     splicing; the pipe keeps the pages alive until they are read. A chunk
+//     whose bytes all went to fused filters instead is reused.
+// If fd is not a pipe, plain write() is used instead.
+//
+// Filter stages are stackless coroutines: a state (reading or writing),
+// a buffer and the filter's counters. Each step does non-blocking reads and
+// writes on the stage's pipe ends until one returns EAGAIN, then yields
+// with the fd and event it is waiting for. native_wait() is the shell's
+// one event loop. It steps runnable coroutines, polls the fds of blocked
+// ones and reaps children as they exit; SIGCHLD wakes the poll through a
+// self-pipe. A coroutine that finishes stays around, like a zombie, until
+// native_wait() reports it under its pseudo pid. Hundreds of stages across
+// concurrent jobs then cost no process and no thread each.
+//
+// A stage on a thread (native_thread_start()) gets a coroutine slot too,
+// but the loop never steps it. The thread closes its own fds when it is
+// done, as an exiting process would (the shell may be busy feeding the
+// pipeline rather than running the loop), then sets a done flag and writes
+// the self-pipe; the loop joins it.
+//
+// Only the argument forms handled exactly are taken over (integer 'seq',
+// any 'yes', 'cat' and 'wc [-lwc]' on stdin, 'head [-n N]' on stdin);
+// everything else runs the real program.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define YES_BUFFER_SIZE (64 * 1024)
+#define SEQ_CHUNK_SIZE  (256 * 1024)
+#define FILTER_BUF_SIZE (64 * 1024)
+#define HEAD_DEFAULT_LINES 10
+
+// Coroutine i is reported as pseudo pid -(i + 2): never a real pid, and
+// never -1 ("any child").
+#define CO_PID(i)  ((pid_t)-((pid_t)(i) + 2))
+#define CO_INDEX(p) ((size_t)(-(p) - 2))
+
+// Parse a decimal long long; false if s is anything else.
+static bool
+parse_ll(const char *s, long long *out)
+{
+    if (s == NULL || *s == '\0') {
+        return false;
+    }
+    char *end = NULL;
+    errno = 0;
+    *out = strtoll(s, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+// Filter stages
+
+typedef enum {
+    FILTER_CAT,
+    FILTER_WC,
+    FILTER_HEAD,
+} filter_kind_t;
+
+typedef struct {
+    filter_kind_t kind;
+    bool          wc_lines, wc_words, wc_bytes;
+    unsigned long long lines, words, bytes;
+    bool          in_word;
+    long long     head_left;   // lines still to pass through
+    bool          satisfied;   // has had all the input it wants
+} native_filter_t;
+
+// Parse a filter's arguments into f; false if the form isn't handled.
+static bool
+parse_filter(char *const argv[], native_filter_t *f)
+{
+    memset(f, 0, sizeof(*f));
+    if (argv == NULL || argv[0] == NULL) {
+        return false;
+    }
+
+    if (strcmp(argv[0], "cat") == 0) {
+        f->kind = FILTER_CAT;
+        return argv[1] == NULL;
+    }
+
+    if (strcmp(argv[0], "wc") == 0) {
+        f->kind = FILTER_WC;
+        for (size_t i = 1; argv[i] != NULL; i++) {
+            if (argv[i][0] != '-' || argv[i][1] == '\0') {
+                return false;  // files, or '-'
+            }
+            for (const char *c = argv[i] + 1; *c != '\0'; c++) {
+                if (*c == 'l') {
+                    f->wc_lines = true;
+                } else if (*c == 'w') {
+                    f->wc_words = true;
+                } else if (*c == 'c') {
+                    f->wc_bytes = true;
+                } else {
+                    return false;
+                }
+            }
+        }
+        if (!f->wc_lines && !f->wc_words && !f->wc_bytes) {
+            f->wc_lines = f->wc_words = f->wc_bytes = true;
+        }
+        return true;
+    }
+
+    if (strcmp(argv[0], "head") == 0) {
+        f->kind = FILTER_HEAD;
+        f->head_left = HEAD_DEFAULT_LINES;
+        if (argv[1] == NULL) {
+            return true;
+        }
+        const char *count = NULL;
+        if (strcmp(argv[1], "-n") == 0 && argv[2] != NULL && argv[3] == NULL) {
+            count = argv[2];
+        } else if (strncmp(argv[1], "-n", 2) == 0 && argv[2] == NULL) {
+            count = argv[1] + 2;
+        }
+        long long n;
+        if (count == NULL || count[0] == '-' || count[0] == '+' ||
+            !parse_ll(count, &n)) {
+            return false;
+        }
+        f->head_left = n;
+        f->satisfied = (n == 0);
+        return true;
+    }
+
+    return false;
+}
+
+// Pass buf[0, *len) through the filter. Filters only ever drop bytes
+// (wc all of them, head those after its last line), so the output is a
+// prefix of buf and buf itself is never written. Returns true once the
+// filter wants no more input.
+static bool
+filter_data(native_filter_t *f, const char *buf, size_t *len)
+{
+    switch (f->kind) {
+    case FILTER_CAT:
+        return false;
+
+    case FILTER_HEAD:
+        for (size_t i = 0; i < *len; i++) {
+            if (buf[i] == '\n' && --f->head_left == 0) {
+                *len = i + 1;
+                return true;
+            }
+        }
+        return false;
+
+    case FILTER_WC:
+        f->bytes += *len;
+        if (!f->wc_words) {
+            // Lines and bytes only: memchr() is far faster than a byte loop.
+            const char *p = buf, *end = buf + *len;
+            while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+                f->lines++;
+                p++;
+            }
+            *len = 0;
+            return false;
+        }
+        for (size_t i = 0; i < *len; i++) {
+            unsigned char c = (unsigned char)buf[i];
+            f->lines += (c == '\n');
+            bool space = (c == ' ' || (c >= '\t' && c <= '\r'));
+            f->words += (!space && !f->in_word);
+            f->in_word = !space;
+        }
+        *len = 0;
+        return false;
+    }
+    return false;
+}
+
+// Output the filter produces at end of input, written into buf.
+static size_t
+filter_finish(native_filter_t *f, char *buf, size_t cap)
+{
+    if (f->kind != FILTER_WC) {
+        return 0;
+    }
+
+    // Like wc reading stdin: a single count unpadded, several in width 7.
+    unsigned long long counts[3];
+    size_t num = 0;
+    if (f->wc_lines) {
+        counts[num++] = f->lines;
+    }
+    if (f->wc_words) {
+        counts[num++] = f->words;
+    }
+    if (f->wc_bytes) {
+        counts[num++] = f->bytes;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < num && used < cap; i++) {
+        int n = snprintf(buf + used, cap - used, num == 1 ? "%s%llu" : "%s%7llu",
+                         i ? " " : "", counts[i]);
+        used += (n > 0) ? (size_t)n : 0;
+    }
+    if (used < cap) {
+        buf[used++] = '\n';
+    }
+    return used < cap ? used : cap;
+}
+
+// Fused filters: consecutive native stages run as one, each passing its
+// output straight to the next. Pass buf[0, *len) through fs[from, n); a
+// satisfied filter lets nothing more through. Returns true once any of them
+// is satisfied, since nothing upstream of it matters any more.
+static bool
+chain_data(native_filter_t *fs, size_t from, size_t n, const char *buf, size_t *len)
+{
+    bool done = false;
+    for (size_t k = from; k < n; k++) {
+        if (fs[k].satisfied) {
+            *len = 0;
+            return true;
+        }
+        if (filter_data(&fs[k], buf, len)) {
+            fs[k].satisfied = true;
+            done = true;
+        }
+    }
+    return done;
+}
+
+// End of input for fused filters: each one's final output, in order, goes
+// through the filters after it. Returns the number of bytes put in buf.
+static size_t
+chain_finish(native_filter_t *fs, size_t n, char *buf, size_t cap)
+{
+    size_t used = 0;
+    for (size_t k = 0; k < n && used < cap; k++) {
+        size_t len = filter_finish(&fs[k], buf + used, cap - used);
+        chain_data(fs, k + 1, n, buf + used, &len);
+        used += len;
+    }
+    return used;
+}
+
+// Parse argvv[0, n) as filters into fs; false if any isn't handled.
+static bool
+parse_chain_filters(char **const argvv[], size_t n, native_filter_t *fs)
+{
+    for (size_t k = 0; k < n; k++) {
+        if (!parse_filter(argvv[k], &fs[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Where a generator's output goes: fd, through any fused filters first.
+typedef struct {
+    int              fd;
+    bool             use_vmsplice;
+    native_filter_t *filters;
+    size_t           num_filters;
+    int              status;   // 1 once a write fails other than with EPIPE
+    bool             spliced;  // the last put may have lent its pages out
+} native_sink_t;
+
+typedef struct {
+    const char *name;
+    bool (*accepts)(char *const argv[]);
+    int  (*run)(char *const argv[], native_sink_t *sink);
+} native_cmd_t;
+
+// Hand len bytes at buf to fd. With use_vmsplice the caller must not
+// modify the pages afterwards. Returns -1 once the reader is gone.
+static int
+feed(int fd, const char *buf, size_t len, bool *use_vmsplice)
+{
+    while (len > 0) {
+        ssize_t n;
+        if (*use_vmsplice) {
+            struct iovec iov = { (void *)buf, len };
+            n = vmsplice(fd, &iov, 1, 0);
+            if (n < 0 && (errno == EINVAL || errno == EBADF || errno == ENOSYS)) {
+                *use_vmsplice = false;  // not a pipe: copy instead
+                continue;
+            }
+        } else {
+            n = write(fd, buf, len);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;  // EPIPE: downstream finished early
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Hand a generator's buffer on. The filters only shorten it, so what is
+// left can still be spliced. Returns -1 when the generator should stop:
+// the reader is gone, or a fused filter wants no more.
+static int
+sink_put(native_sink_t *sink, const char *buf, size_t len)
+{
+    bool done = chain_data(sink->filters, 0, sink->num_filters, buf, &len);
+    sink->spliced = len > 0 && sink->use_vmsplice;
+    if (feed(sink->fd, buf, len, &sink->use_vmsplice) < 0) {
+        sink->status = (errno == EPIPE) ? 0 : 1;
+        return -1;
+    }
+    return done ? -1 : 0;
+}
+
+// After the generator: the fused filters' final output (e.g. wc's counts).
+static void
+sink_finish(native_sink_t *sink)
+{
+    if (sink->num_filters == 0 || sink->status != 0) {
+        return;
+    }
+    char buf[4096];
+    size_t len = chain_finish(sink->filters, sink->num_filters, buf, sizeof(buf));
+    bool copy = false;  // buf is on the stack: never splice it
+    if (feed(sink->fd, buf, len, &copy) < 0 && errno != EPIPE) {
+        sink->status = 1;
+    }
+}
+
+// seq LAST | seq FIRST LAST | seq FIRST INCR LAST, integers only.
+static bool
+seq_args(char *const argv[], long long *first, long long *incr, long long *last)
+{
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    *first = 1;
+    *incr = 1;
+    switch (argc) {
+    case 2:
+        return parse_ll(argv[1], last);
+    case 3:
+        return parse_ll(argv[1], first) && parse_ll(argv[2], last);
+    case 4:
+        return parse_ll(argv[1], first) && parse_ll(argv[2], incr) &&
+               parse_ll(argv[3], last) && *incr != 0;
+    default:
+        return false;
+    }
+}
+
+static bool
+seq_accepts(char *const argv[])
+{
+    long long first, incr, last;
+    return seq_args(argv, &first, &incr, &last);
+}
+
+// Format v followed by '\n' at p; returns the number of bytes written.
+static size_t
+format_line(char *p, long long v)
+{
+    char tmp[24];
+    size_t n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+
+    size_t len = 0;
+    if (v < 0) {
+        p[len++] = '-';
+    }
+    while (n > 0) {
+        p[len++] = tmp[--n];
+    }
+    p[len++] = '\n';
+    return len;
+}
+
+static int
+seq_run(char *const argv[], native_sink_t *sink)
+{
+    long long first, incr, last;
+    if (!seq_args(argv, &first, &incr, &last)) {
+        return 1;
+    }
+
+    long long v = first;
+    bool more = incr > 0 ? v <= last : v >= last;
+    char *chunk = NULL;
+    while (more) {
+        if (chunk == NULL) {
+            chunk = mmap(NULL, SEQ_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED) {
+                perror("seq: mmap");
+                return 1;
+            }
+        }
+
+        size_t used = 0;
+        while (more && used + 24 <= SEQ_CHUNK_SIZE) {
+            used += format_line(chunk + used, v);
+            // Stop at last, or where v + incr would overflow.
+            long long next;
+            more = !__builtin_add_overflow(v, incr, &next) &&
+                   (incr > 0 ? next <= last : next >= last);
+            v = more ? next : v;
+        }
+
+        int rc = sink_put(sink, chunk, used);
+        if (sink->spliced) {
+            munmap(chunk, SEQ_CHUNK_SIZE);  // the pipe still holds its pages
+            chunk = NULL;
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+    if (chunk != NULL) {
+        munmap(chunk, SEQ_CHUNK_SIZE);
+    }
+    return 0;
+}
+
+static bool
+yes_accepts(char *const argv[])
+{
+    (void)argv;
+    return true;
+}
+
+static int
+yes_run(char *const argv[], native_sink_t *sink)
+{
+    // One line: the arguments joined by spaces, or "y".
+    size_t line_len = 0;
+    for (size_t i = 1; argv[i] != NULL; i++) {
+        line_len += strlen(argv[i]) + 1;
+    }
+    if (line_len == 0) {
+        line_len = 2;
+    }
+
+    // Whole lines only, so every splice ends on a line boundary.
+    size_t size = YES_BUFFER_SIZE;
+    if (line_len > size) {
+        size = line_len;
+    }
+    size -= size % line_len;
+
+    char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("yes: mmap");
+        return 1;
+    }
+
+    char *p = buf;
+    if (argv[1] == NULL) {
+        memcpy(p, "y\n", 2);
+    } else {
+        for (size_t i = 1; argv[i] != NULL; i++) {
+            size_t len = strlen(argv[i]);
+            memcpy(p, argv[i], len);
+            p[len] = argv[i + 1] != NULL ? ' ' : '\n';
+            p += len + 1;
+        }
+    }
+    for (size_t off = line_len; off < size; off += line_len) {
+        memcpy(buf + off, buf, line_len);
+    }
+
+    while (sink_put(sink, buf, size) == 0) {
+    }
+
+    // Spliced pages may still sit in the pipe; they stay valid after this.
+    munmap(buf, size);
+    return 0;
+}
+
+static const native_cmd_t native_cmds[] = {
+    { "seq", seq_accepts, seq_run },
+    { "yes", yes_accepts, yes_run },
+};
+
+static const native_cmd_t *
+find_native(char *const argv[])
+{
+    if (argv == NULL || argv[0] == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(native_cmds) / sizeof(native_cmds[0]); i++) {
+        if (strcmp(argv[0], native_cmds[i].name) == 0 && native_cmds[i].accepts(argv)) {
+            return &native_cmds[i];
+        }
+    }
+    return NULL;
+}
+
+bool
+is_native_generator(char *const argv[])
+{
+    // A plugin builtin of the same name takes precedence.
+    return find_native(argv) != NULL && plugin_flags(argv[0]) == 0;
+}
+
+void
+ignore_sigpipe(struct sigaction *saved)
+{
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, saved);
+}
+
+void
+restore_sigpipe(const struct sigaction *saved)
+{
+    sigaction(SIGPIPE, saved, NULL);
+}
+
+int
+run_native_stages(char **const argvv[], size_t n, int fd)
+{
+    const native_cmd_t *cmd = find_native(argvv[0]);
+    native_filter_t filters[n > 1 ? n - 1 : 1];
+    if (cmd == NULL || !parse_chain_filters(argvv + 1, n - 1, filters)) {
+        return -1;
+    }
+    native_sink_t sink = { fd, true, filters, n - 1, 0, false };
+
+    // A reader that exits early must show up as EPIPE, not kill the shell.
+    struct sigaction saved;
+    ignore_sigpipe(&saved);
+
+    int status = cmd->run(argvv[0], &sink);
+    sink_finish(&sink);
+
+    restore_sigpipe(&saved);
+    // The last stage decides: the generator's status, else the filters'.
+    return (n == 1) ? status : sink.status;
+}
+
+// Filter coroutines
+
+typedef enum {
+    CO_READ,
+    CO_WRITE,
+    CO_DONE,
+} co_state_t;
+
+// A stage running on its own thread. Shared with the thread, so it lives
+// outside cos[], which may move.
+typedef struct {
+    pthread_t  thread;
+    int      (*run)(void *arg, int in_fd, int out_fd);
+    void      *arg;
+    int        in_fd;
+    int        out_fd;
+    int        status;
+    int        done;   // set (release) once status is final
+} native_task_t;
+
+typedef struct {
+    bool            used;
+    bool            orphaned;      // cancelled: drop it once it finishes
+    co_state_t      state;
+    int             in_fd;
+    int             out_fd;
+    short           wait_events;   // 0: runnable; else POLLIN / POLLOUT
+    bool            input_done;    // EOF, or the filters want no more
+    bool            finishing;     // the buffer holds the final output
+    int             status;
+    native_filter_t *filters;      // one per fused stage
+    size_t          num_filters;
+    char           *buf;
+    size_t          len;
+    size_t          off;
+    native_task_t  *task;          // a thread instead of filters, or NULL
+} native_co_t;
+
+static native_co_t *cos;
+static size_t       cap_cos;
+static size_t       live_cos;      // used and not yet CO_DONE
+static int          wake_pipe[2] = { -1, -1 };
+
+static void
+set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void
+on_sigchld(int sig)
+{
+    (void)sig;
+    int saved = errno;
+    (void)!write(wake_pipe[1], "", 1);
+    errno = saved;
+}
+
+// SIGCHLD has to interrupt the event loop's poll().
+static int
+install_wakeup(void)
+{
+    if (wake_pipe[0] >= 0) {
+        return 0;
+    }
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sa.sa_handler = on_sigchld;
+    sigaction(SIGCHLD, &sa, NULL);
+    return 0;
+}
+
+static void
+drain_wakeup(void)
+{
+    char buf[64];
+    while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+}
+
+static void
+co_close_input(native_co_t *co)
+{
+    if (co->in_fd >= 0) {
+        close(co->in_fd);  // upstream now gets EPIPE, as with a real head
+        co->in_fd = -1;
+    }
+}
+
+static void
+co_finish(native_co_t *co, int status)
+{
+    co_close_input(co);
+    if (co->out_fd >= 0) {
+        close(co->out_fd);
+        co->out_fd = -1;
+    }
+    free(co->buf);
+    free(co->filters);
+    co->buf = NULL;
+    co->filters = NULL;
+    co->status = status;
+    co->state = CO_DONE;
+    co->wait_events = 0;
+    live_cos--;
+}
+
+// Run co until it blocks or finishes.
+static void
+co_step(native_co_t *co)
+{
+    while (co->state != CO_DONE) {
+        if (co->state == CO_READ) {
+            if (co->input_done) {
+                co_close_input(co);
+                co->len = chain_finish(co->filters, co->num_filters, co->buf,
+                                       FILTER_BUF_SIZE);
+                co->off = 0;
+                co->finishing = true;
+                co->state = CO_WRITE;
+                continue;
+            }
+            ssize_t n = read(co->in_fd, co->buf, FILTER_BUF_SIZE);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN) {
+                co->wait_events = POLLIN;
+                return;  // yield
+            }
+            if (n <= 0) {
+                co->input_done = true;
+                continue;
+            }
+            co->len = (size_t)n;
+            co->off = 0;
+            co->input_done = chain_data(co->filters, 0, co->num_filters,
+                                        co->buf, &co->len);
+            co->state = CO_WRITE;
+        } else {
+            while (co->off < co->len) {
+                ssize_t n = write(co->out_fd, co->buf + co->off, co->len - co->off);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && errno == EAGAIN) {
+                    co->wait_events = POLLOUT;
+                    return;  // yield
+                }
+                if (n < 0) {
+                    // Downstream is gone (EPIPE): stop, like SIGPIPE would.
+                    co_finish(co, errno == EPIPE ? 0 : 1);
+                    return;
+                }
+                co->off += (size_t)n;
+            }
+            if (co->finishing) {
+                co_finish(co, 0);
+                return;
+            }
+            co->state = CO_READ;
+        }
+    }
+}
+
+// Join the threads that have finished; true if there were any.
+static bool
+reap_threads(void)
+{
+    bool reaped = false;
+    for (size_t i = 0; i < cap_cos; i++) {
+        native_co_t *co = &cos[i];
+        if (!co->used || co->task == NULL ||
+            !__atomic_load_n(&co->task->done, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        pthread_join(co->task->thread, NULL);
+        int status = co->task->status;
+        free(co->task);
+        co->task = NULL;
+        co_finish(co, status);
+        if (co->orphaned) {
+            co->used = false;
+        }
+        reaped = true;
+    }
+    return reaped;
+}
+
+static void
+step_runnable(void)
+{
+    reap_threads();
+    for (size_t i = 0; i < cap_cos; i++) {
+        if (cos[i].used && cos[i].state != CO_DONE && cos[i].wait_events == 0 &&
+            cos[i].task == NULL) {
+            co_step(&cos[i]);
+        }
+    }
+}
+
+// Sleep until a blocked coroutine can make progress, a child exits, or
+// (extra_fd >= 0) extra_fd is readable. Returns true if extra_fd is.
+static bool
+poll_blocked(int extra_fd)
+{
+    size_t max = live_cos + 2;
+    struct pollfd pfds[max];
+    size_t owner[max];
+    size_t n = 0;
+
+    pfds[n].fd = wake_pipe[0];
+    pfds[n].events = POLLIN;
+    n++;
+    if (extra_fd >= 0) {
+        pfds[n].fd = extra_fd;
+        pfds[n].events = POLLIN;
+        n++;
+    }
+    size_t first_co = n;
+    for (size_t i = 0; i < cap_cos && n < max; i++) {
+        native_co_t *co = &cos[i];
+        if (co->used && co->state != CO_DONE && co->wait_events != 0) {
+            pfds[n].fd = (co->wait_events == POLLIN) ? co->in_fd : co->out_fd;
+            pfds[n].events = co->wait_events;
+            owner[n] = i;
+            n++;
+        }
+    }
+
+    if (poll(pfds, n, -1) < 0) {
+        return false;  // EINTR: the caller just loops
+    }
+    for (size_t k = first_co; k < n; k++) {
+        if (pfds[k].revents != 0) {
+            cos[owner[k]].wait_events = 0;
+        }
+    }
+    return extra_fd >= 0 && pfds[1].revents != 0;
+}
+
+// A finished coroutine to report: pid itself, or any one for pid -1.
+static native_co_t *
+find_done(pid_t pid)
+{
+    if (pid < -1) {
+        size_t i = CO_INDEX(pid);
+        return (i < cap_cos && cos[i].used && cos[i].state == CO_DONE) ? &cos[i] : NULL;
+    }
+    for (size_t i = 0; pid == -1 && i < cap_cos; i++) {
+        if (cos[i].used && cos[i].state == CO_DONE) {
+            return &cos[i];
+        }
+    }
+    return NULL;
+}
+
+// A free, zeroed coroutine slot (not yet marked used), or NULL.
+static native_co_t *
+claim_co(void)
+{
+    size_t i = 0;
+    while (i < cap_cos && cos[i].used) {
+        i++;
+    }
+    if (i == cap_cos) {
+        size_t cap = cap_cos ? cap_cos * 2 : 16;
+        native_co_t *grown = realloc(cos, cap * sizeof(*cos));
+        if (grown == NULL) {
+            return NULL;
+        }
+        memset(grown + cap_cos, 0, (cap - cap_cos) * sizeof(*cos));
+        cos = grown;
+        cap_cos = cap;
+    }
+    memset(&cos[i], 0, sizeof(cos[i]));
+    return &cos[i];
+}
+
+bool
+is_native_filter(char *const argv[])
+{
+    native_filter_t f;
+    return parse_filter(argv, &f) && plugin_flags(argv[0]) == 0;
+}
+
+pid_t
+native_filter_start(char **const argvv[], size_t n, int in_fd, int out_fd, bool own_out)
+{
+    native_filter_t *filters = malloc(n * sizeof(*filters));
+    if (filters == NULL || !parse_chain_filters(argvv, n, filters) ||
+        install_wakeup() < 0) {
+        free(filters);
+        return -1;
+    }
+
+    native_co_t *co = claim_co();
+    if (co == NULL) {
+        free(filters);
+        return -1;
+    }
+    co->buf = malloc(FILTER_BUF_SIZE);
+    if (co->buf == NULL) {
+        free(filters);
+        return -1;
+    }
+    co->used   = true;
+    co->state  = CO_READ;
+    co->in_fd  = in_fd;
+    co->out_fd = out_fd;
+    co->filters = filters;
+    co->num_filters = n;
+    for (size_t k = 0; k < n; k++) {
+        co->input_done |= filters[k].satisfied;  // 'head -n 0'
+    }
+    set_nonblocking(in_fd);
+    if (own_out) {
+        set_nonblocking(out_fd);
+    } else {
+        fcntl(out_fd, F_SETFD, FD_CLOEXEC);
+    }
+    live_cos++;
+    return CO_PID(co - cos);
+}
+
+int
+native_open_stdout(bool *own)
+{
+    struct stat st;
+    if (fstat(STDOUT_FILENO, &st) < 0) {
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        // A write to a file never waits for a reader: blocking is harmless.
+        *own = false;
+        return fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    if (!S_ISFIFO(st.st_mode)) {
+        return -1;  // a terminal or socket could block the whole shell
+    }
+    // Opening the pipe again gives the coroutine its own file description,
+    // so O_NONBLOCK stays off the stdout other processes share. With no
+    // reader left this fails (ENXIO), and the real program gets the EPIPE.
+    *own = true;
+    return open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+static void *
+task_main(void *arg)
+{
+    native_task_t *task = arg;
+    task->status = task->run(task->arg, task->in_fd, task->out_fd);
+    close(task->in_fd);
+    close(task->out_fd);
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+    (void)!write(wake_pipe[1], "", 1);
+    return NULL;
+}
+
+pid_t
+native_thread_start(int (*run)(void *arg, int in_fd, int out_fd), void *arg,
+                    int in_fd, int out_fd)
+{
+    native_task_t *task = calloc(1, sizeof(*task));
+    native_co_t *co = NULL;
+    if (task == NULL || install_wakeup() < 0 || (co = claim_co()) == NULL) {
+        free(task);
+        return -1;
+    }
+    task->run    = run;
+    task->arg    = arg;
+    task->in_fd  = in_fd;
+    task->out_fd = out_fd;
+    // Other children must not hold the stage's pipe ends open.
+    fcntl(in_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(out_fd, F_SETFD, FD_CLOEXEC);
+
+    // With every signal blocked the thread never runs the SIGCHLD handler,
+    // and a write to a closed pipe fails with EPIPE instead of killing us.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int err = pthread_create(&task->thread, NULL, task_main, task);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (err != 0) {
+        errno = err;
+        perror("pthread_create");
+        free(task);
+        return -1;
+    }
+
+    co->used   = true;
+    co->state  = CO_READ;  // never stepped; see reap_threads()
+    co->in_fd  = -1;       // the thread's own
+    co->out_fd = -1;
+    co->task   = task;
+    live_cos++;
+    return CO_PID(co - cos);
+}
+
+void
+native_cancel(pid_t pid)
+{
+    if (pid >= -1 || CO_INDEX(pid) >= cap_cos || !cos[CO_INDEX(pid)].used) {
+        return;
+    }
+    native_co_t *co = &cos[CO_INDEX(pid)];
+    if (co->task != NULL) {
+        co->orphaned = true;  // a thread can't be stopped; let it run out
+        return;
+    }
+    if (co->state != CO_DONE) {
+        co_finish(co, 1);
+    }
+    co->used = false;
+}
+
+void
+native_after_fork(void)
+{
+    for (size_t i = 0; i < cap_cos; i++) {
+        if (cos[i].used) {
+            if (cos[i].in_fd >= 0) close(cos[i].in_fd);
+            if (cos[i].out_fd >= 0) close(cos[i].out_fd);
+            free(cos[i].buf);
+            free(cos[i].filters);
+            free(cos[i].task);  // the thread stayed in the parent
+        }
+    }
+    free(cos);
+    cos = NULL;
+    cap_cos = 0;
+    live_cos = 0;
+
+    // The parent's wake pipe must not hear about our children.
+    if (wake_pipe[0] >= 0) {
+        signal(SIGCHLD, SIG_DFL);
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+}
+
+pid_t
+native_wait(pid_t pid, int *wstatus, struct rusage *ru)
+{
+    bool pseudo = pid < -1;
+    if (!pseudo && live_cos == 0 && find_done(-1) == NULL) {
+        return wait4(pid, wstatus, 0, ru);  // no coroutines: a plain wait
+    }
+
+    // A reader that exits early must show up as EPIPE, not kill the shell.
+    struct sigaction saved;
+    ignore_sigpipe(&saved);
+
+    pid_t result = -1;
+    while (true) {
+        step_runnable();
+
+        native_co_t *co = find_done(pid);
+        if (co != NULL) {
+            result = CO_PID(co - cos);
+            if (wstatus != NULL) {
+                *wstatus = W_EXITCODE(co->status, 0);
+            }
+            if (ru != NULL) {
+                memset(ru, 0, sizeof(*ru));  // it ran inside the shell
+            }
+            co->used = false;
+            break;
+        }
+        if (pseudo && (CO_INDEX(pid) >= cap_cos || !cos[CO_INDEX(pid)].used)) {
+            errno = ECHILD;
+            break;
+        }
+
+        drain_wakeup();
+        if (reap_threads()) {
+            continue;  // it may have finished after the step above
+        }
+        if (!pseudo) {
+            result = wait4(pid, wstatus, (live_cos > 0) ? WNOHANG : 0, ru);
+            if (result < 0 && errno == ECHILD && pid == -1 && live_cos > 0) {
+                result = 0;  // no children, but coroutines still to finish
+            }
+            if (result != 0) {
+                break;  // a child, or an error such as ECHILD
+            }
+        }
+        poll_blocked(-1);
+    }
+
+    restore_sigpipe(&saved);
+    return result;
+}
+
+void
+native_wait_input(int fd)
+{
+    if (live_cos == 0) {
+        return;
+    }
+
+    struct sigaction saved;
+    ignore_sigpipe(&saved);
+
+    while (true) {
+        step_runnable();
+        if (live_cos == 0) {
+            break;
+        }
+        drain_wakeup();
+        if (reap_threads()) {
+            continue;
+        }
+        if (poll_blocked(fd)) {
+            break;
+        }
+    }
+
+    restore_sigpipe(&saved);
+}
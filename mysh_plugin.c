@@ -0,0 +1,272 @@
+// Builtin plugins for mysh.
+//
+// This file is responsible for:
+//   - Loading the shared objects in the plugin directory and running their
+//     mysh_plugin_init() (the ABI is in mysh_plugin.h)
+//   - The table of builtins they register, which is_builtin() consults
+//   - Running a plugin builtin in the calling process or on its own thread
+//
+// Where a builtin runs is decided by the callers in mysh_cmds.c from its
+// flags: in the shell for a command on its own (MYSH_BUILTIN_PARENT), on a
+// thread for a pipeline stage (MYSH_BUILTIN_THREAD), else in the stage's
+// forked child. None of them fork+exec.
+//
+// Registered names are interned, so looking up a parsed command name is a
+// pointer compare per plugin builtin. Plugins stay loaded for the life of
+// the shell.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <signal.h>
+
+typedef struct {
+    const char      *name;   // interned, unless the table was full
+    unsigned         flags;
+    mysh_builtin_fn  run;
+    void            *data;
+} plugin_builtin_t;
+
+// One builtin call on a thread: its own copy of everything, since the job
+// may be freed before a cancelled stage finishes.
+typedef struct {
+    plugin_builtin_t builtin;
+    int              argc;
+    char           **argv;
+} thread_call_t;
+
+static plugin_builtin_t *builtins     = NULL;
+static size_t            num_builtins = 0;
+static size_t            cap_builtins = 0;
+
+static const plugin_builtin_t *
+find_builtin(const char *name)
+{
+    if (name == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < num_builtins; i++) {
+        if (builtins[i].name == name) {
+            return &builtins[i];
+        }
+    }
+    // An interned name only ever matches itself; others need a compare.
+    if (is_interned(name)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < num_builtins; i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+static bool
+is_shell_word(const char *name)
+{
+    for (word_t w = 0; w < NUM_WORDS; w++) {
+        if (is_word(name, w)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int
+plugin_register(const mysh_builtin_def_t *def)
+{
+    unsigned known = MYSH_BUILTIN_PARENT | MYSH_BUILTIN_CHILD | MYSH_BUILTIN_THREAD;
+    if (def == NULL || def->name == NULL || def->name[0] == '\0' ||
+        strchr(def->name, '/') != NULL || def->run == NULL ||
+        (def->flags & known) == 0 || (def->flags & ~known) != 0) {
+        print_mysh_error("plugin", "invalid builtin definition");
+        return -1;
+    }
+    if (is_shell_word(def->name) || is_builtin(def->name)) {
+        print_mysh_error(def->name, "builtin name already taken");
+        return -1;
+    }
+
+    if (num_builtins == cap_builtins) {
+        size_t cap = cap_builtins ? cap_builtins * 2 : 8;
+        plugin_builtin_t *grown = realloc(builtins, cap * sizeof(*grown));
+        if (grown == NULL) {
+            print_mysh_error("plugin", "failed to allocate builtin table");
+            return -1;
+        }
+        builtins = grown;
+        cap_builtins = cap;
+    }
+    char *name = intern(def->name);
+    if (name == NULL) {
+        print_mysh_error("plugin", "failed to allocate builtin name");
+        return -1;
+    }
+
+    plugin_builtin_t *b = &builtins[num_builtins++];
+    b->name  = name;
+    b->flags = def->flags;
+    b->run   = def->run;
+    b->data  = def->data;
+    return 0;
+}
+
+static const mysh_plugin_api_t plugin_api = {
+    .abi_version      = MYSH_PLUGIN_ABI_VERSION,
+    .register_builtin = plugin_register,
+};
+
+static bool
+has_so_suffix(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 3 && strcmp(name + len - 3, ".so") == 0;
+}
+
+static int
+select_plugin(const struct dirent *entry)
+{
+    return entry->d_name[0] != '.' && has_so_suffix(entry->d_name);
+}
+
+// Load one plugin; a plugin whose init fails keeps none of its builtins.
+static int
+load_plugin(const char *path)
+{
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        print_mysh_error("plugin", dlerror());
+        return -1;
+    }
+
+    mysh_plugin_init_fn init;
+    *(void **)&init = dlsym(handle, "mysh_plugin_init");
+    if (init == NULL) {
+        print_mysh_error(path, "no mysh_plugin_init()");
+        dlclose(handle);
+        return -1;
+    }
+
+    size_t before = num_builtins;
+    if (init(&plugin_api) != 0) {
+        print_mysh_error(path, "plugin initialization failed");
+        num_builtins = before;
+        dlclose(handle);
+        return -1;
+    }
+    return 0;
+}
+
+int
+plugin_load_dir(const char *dir)
+{
+    struct dirent **entries = NULL;
+    int n = scandir(dir, &entries, select_plugin, alphasort);
+    if (n < 0) {
+        perror(dir);
+        return -1;
+    }
+
+    int loaded = 0;
+    for (int i = 0; i < n; i++) {
+        char path[4096];
+        int len = snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+        if (len > 0 && (size_t)len < sizeof(path) && load_plugin(path) == 0) {
+            loaded++;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return loaded;
+}
+
+unsigned
+plugin_flags(const char *name)
+{
+    const plugin_builtin_t *b = find_builtin(name);
+    return b != NULL ? b->flags : 0;
+}
+
+static int
+count_args(char *const argv[])
+{
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    return argc;
+}
+
+int
+plugin_run(char *const argv[], int in_fd, int out_fd, int err_fd)
+{
+    const plugin_builtin_t *b = find_builtin(argv[0]);
+    if (b == NULL) {
+        return 127;
+    }
+
+    struct sigaction saved;
+    ignore_sigpipe(&saved);
+
+    int status = b->run(count_args(argv), argv, in_fd, out_fd, err_fd, b->data);
+
+    restore_sigpipe(&saved);
+    return status;
+}
+
+static void
+free_call(thread_call_t *call)
+{
+    for (int i = 0; i < call->argc; i++) {
+        free(call->argv[i]);
+    }
+    free(call->argv);
+    free(call);
+}
+
+static int
+run_call(void *arg, int in_fd, int out_fd)
+{
+    thread_call_t *call = arg;
+    const plugin_builtin_t *b = &call->builtin;
+    int status = b->run(call->argc, call->argv, in_fd, out_fd, STDERR_FILENO, b->data);
+    free_call(call);
+    return status;
+}
+
+pid_t
+plugin_thread_start(char *const argv[], int in_fd, int out_fd)
+{
+    const plugin_builtin_t *b = find_builtin(argv[0]);
+    thread_call_t *call = calloc(1, sizeof(*call));
+    if (b == NULL || call == NULL) {
+        free(call);
+        return -1;
+    }
+    call->builtin = *b;
+    call->argv = calloc((size_t)count_args(argv) + 1, sizeof(char *));
+    if (call->argv == NULL) {
+        free(call);
+        return -1;
+    }
+    for (; argv[call->argc] != NULL; call->argc++) {
+        call->argv[call->argc] = strdup(argv[call->argc]);
+        if (call->argv[call->argc] == NULL) {
+            free_call(call);
+            return -1;
+        }
+    }
+
+    pid_t pid = native_thread_start(run_call, call, in_fd, out_fd);
+    if (pid == -1) {
+        free_call(call);
+    }
+    return pid;
+}
@@ -0,0 +1,67 @@
+#ifndef MYSH_PLUGIN_H
+#define MYSH_PLUGIN_H
+
+/*
+ * Plugin ABI for mysh builtins.
+ *
+ * A plugin is a shared object in the plugin directory (mysh --plugins DIR,
+ * or $MYSH_PLUGIN_DIR). mysh dlopen()s each *.so there at startup and calls
+ * its exported
+ *
+ *     int mysh_plugin_init(const mysh_plugin_api_t *api);
+ *
+ * which checks api->abi_version and registers its builtins with
+ * api->register_builtin(). Returning nonzero unloads the plugin; builtins
+ * it registered before failing stay unregistered.
+ *
+ * This header is all a plugin needs; it does not depend on mysh.h.
+ */
+
+#define MYSH_PLUGIN_ABI_VERSION 1
+
+/*
+ * Where a builtin may run (mysh_builtin_def_t.flags). mysh picks the
+ * cheapest one the builtin allows:
+ *   MYSH_BUILTIN_PARENT  a command on its own runs in the shell process,
+ *                        with its redirections applied; no fork.
+ *   MYSH_BUILTIN_THREAD  a pipeline stage runs on its own thread inside the
+ *                        shell, with the stage's pipe ends as its fds. The
+ *                        entry point must be thread-safe and must not touch
+ *                        the shell's stdio or process-wide state.
+ *   MYSH_BUILTIN_CHILD   a pipeline stage runs in a forked child (as the
+ *                        shell's own builtins do), with stdin/stdout wired
+ *                        to the pipes; nothing is exec()ed.
+ * A builtin with none that fits is refused with an error.
+ */
+#define MYSH_BUILTIN_PARENT 0x1u
+#define MYSH_BUILTIN_CHILD  0x2u
+#define MYSH_BUILTIN_THREAD 0x4u
+
+/*
+ * Entry point: argv[0] is the builtin's name. Input is read from in_fd and
+ * output written to out_fd / err_fd with write(2), not stdio; they are not
+ * necessarily 0, 1 and 2, and they belong to mysh, so leave them open. A
+ * write may fail with EPIPE when the reader is gone (SIGPIPE is blocked or
+ * ignored while a builtin runs); stop quietly then. The return value is
+ * the exit status.
+ */
+typedef int (*mysh_builtin_fn)(int argc, char *const argv[],
+                               int in_fd, int out_fd, int err_fd,
+                               void *data);
+
+typedef struct {
+    const char      *name;    /* copied; may not be a shell builtin */
+    unsigned         flags;   /* MYSH_BUILTIN_* */
+    mysh_builtin_fn  run;
+    void            *data;    /* passed to run as is */
+} mysh_builtin_def_t;
+
+typedef struct {
+    unsigned abi_version;     /* MYSH_PLUGIN_ABI_VERSION */
+    /* 0 on success; -1 if the name is taken or the definition invalid. */
+    int (*register_builtin)(const mysh_builtin_def_t *def);
+} mysh_plugin_api_t;
+
+typedef int (*mysh_plugin_init_fn)(const mysh_plugin_api_t *api);
+
+#endif /* MYSH_PLUGIN_H */
@@ -0,0 +1,185 @@
+// Prepared job templates for mysh.
+//
+// This file is responsible for:
+//   - Parsing a job once and resolving its program paths up front
+//   - Binding "$1", "$2", ... placeholders to new values on every run
+//   - Running the bound job through execute_job()
+//
+// Binding only stores pointers into argv arrays the template owns, so
+// executing a template allocates nothing and never touches the tokenizer,
+// parse_line() or resolve_program_path().
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// One placeholder: where its value goes, and which value ($index).
+typedef struct {
+    char  **where;
+    size_t  index;
+} template_slot_t;
+
+struct job_template {
+    job_t            job;        // as parsed; owns all strings and paths
+    job_t            bound;      // same job with per-template argv copies
+    template_slot_t *slots;
+    size_t           num_slots;
+};
+
+// "$N" with N >= 1 -> N; anything else -> 0.
+static size_t
+placeholder_index(const char *token)
+{
+    if (token == NULL || token[0] != '$' || token[1] == '\0') {
+        return 0;
+    }
+    size_t n = 0;
+    for (const char *p = token + 1; *p; p++) {
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        n = n * 10 + (size_t)(*p - '0');
+    }
+    return n;
+}
+
+static int
+add_slot(job_template_t *tmpl, char **where)
+{
+    size_t index = placeholder_index(*where);
+    if (index == 0) {
+        return 0;
+    }
+
+    template_slot_t *grown =
+        realloc(tmpl->slots, (tmpl->num_slots + 1) * sizeof(*tmpl->slots));
+    if (grown == NULL) {
+        return -1;
+    }
+    tmpl->slots = grown;
+    tmpl->slots[tmpl->num_slots].where = where;
+    tmpl->slots[tmpl->num_slots].index = index;
+    tmpl->num_slots++;
+    return 0;
+}
+
+job_template_t *
+prepare_job(const char *line)
+{
+    job_template_t *tmpl = calloc(1, sizeof(*tmpl));
+    size_t len = strlen(line) + 1;
+    char *copy = malloc(len);
+    if (tmpl == NULL || copy == NULL) {
+        print_mysh_error("malloc", "failed to allocate template");
+        free(tmpl);
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy, line, len);
+
+    // parse_line() writes into the line; tokens are copied out of it.
+    int parse_status = parse_line(copy, &tmpl->job);
+    free(copy);
+    if (parse_status <= 0) {
+        if (parse_status == 0) {
+            print_mysh_error("prepare", "empty job");
+        }
+        goto fail;
+    }
+    if (tmpl->job.cond != COND_NONE) {
+        print_mysh_error("prepare", "conditional not allowed in a template");
+        goto fail;
+    }
+
+    job_t *job = &tmpl->job;
+    job->paths = calloc(job->num_procs, sizeof(char *));
+    tmpl->bound = *job;
+    tmpl->bound.argvv = calloc(job->num_procs, sizeof(char **));
+    if (job->paths == NULL || tmpl->bound.argvv == NULL) {
+        print_mysh_error("malloc", "failed to allocate template");
+        goto fail;
+    }
+
+    for (size_t i = 0; i < job->num_procs; i++) {
+        char **argv = job->argvv[i];
+        size_t argc = 0;
+        while (argv[argc] != NULL) {
+            argc++;
+        }
+
+        if (!is_builtin(argv[0])) {
+            if (placeholder_index(argv[0]) != 0) {
+                print_mysh_error("prepare", "command name cannot be a placeholder");
+                goto fail;
+            }
+            job->paths[i] = resolve_program_path(argv[0]);
+            if (job->paths[i] == NULL) {
+                print_mysh_error(argv[0], "command not found");
+                goto fail;
+            }
+        }
+
+        char **bound_argv = malloc((argc + 1) * sizeof(char *));
+        if (bound_argv == NULL) {
+            print_mysh_error("malloc", "failed to allocate template");
+            goto fail;
+        }
+        memcpy(bound_argv, argv, (argc + 1) * sizeof(char *));
+        tmpl->bound.argvv[i] = bound_argv;
+
+        for (size_t a = 1; a < argc; a++) {
+            if (add_slot(tmpl, &bound_argv[a]) < 0) {
+                goto fail;
+            }
+        }
+    }
+    tmpl->bound.paths = job->paths;
+
+    if (add_slot(tmpl, &tmpl->bound.infile) < 0 ||
+        add_slot(tmpl, &tmpl->bound.outfile) < 0) {
+        goto fail;
+    }
+    return tmpl;
+
+fail:
+    free_prepared(tmpl);
+    return NULL;
+}
+
+exec_action_t
+execute_prepared(job_template_t *tmpl, char *const values[], size_t num_values,
+                 bool input_is_tty, int *cmd_status)
+{
+    for (size_t i = 0; i < tmpl->num_slots; i++) {
+        size_t index = tmpl->slots[i].index;
+        if (index > num_values || values[index - 1] == NULL) {
+            fprintf(stderr, "mysh: prepare: no value for $%zu\n", index);
+            if (cmd_status != NULL) {
+                *cmd_status = 1;
+            }
+            return EXEC_CONTINUE;
+        }
+        *tmpl->slots[i].where = values[index - 1];
+    }
+
+    return execute_job(&tmpl->bound, input_is_tty, cmd_status);
+}
+
+void
+free_prepared(job_template_t *tmpl)
+{
+    if (tmpl == NULL) {
+        return;
+    }
+    if (tmpl->bound.argvv != NULL) {
+        for (size_t i = 0; i < tmpl->job.num_procs; i++) {
+            free(tmpl->bound.argvv[i]);
+        }
+        free(tmpl->bound.argvv);
+    }
+    free(tmpl->slots);
+    free_job(&tmpl->job);
+    free(tmpl);
+}
@@ -0,0 +1,377 @@
+// Progress and ETA reporting for long batch runs (--progress[=FD]).
+//
+// This file is responsible for:
+//   - Counting the bytes, lines and jobs the read loop has consumed
+//   - Writing a throttled progress line: how much of the script has been
+//     read, jobs per second, the time so far and an ETA
+//   - Keeping a history of how long the last complete run of the script
+//     took to reach each point, and basing the ETA on it
+//
+// The read loop calls progress_line() once per line, with the line's
+// length; that is its offset bookkeeping, so nothing here seeks or stats
+// while the script runs. With progress off the call is one branch. With it
+// on, it adds a coarse clock read (vDSO, no syscall), and only once every
+// PROGRESS_INTERVAL_MS is anything formatted or written.
+//
+// Without a history the ETA is the running rate: the time so far, scaled
+// by the bytes still to read. The history is SCRIPT.progress, written when
+// a run reads the script to the end: up to PROGRESS_MAX_MARKS (offset,
+// seconds) marks, each the summed durations of the lines before that
+// offset. It is only trusted while the script keeps its size. With it, the
+// ETA is the time the last run still needed from the current offset,
+// scaled by how this run's pace compares to the last one's, so a slow
+// stretch the last run went through is expected again at the same place.
+//
+// Under -j the loop reads ahead of the jobs it starts, so the offset
+// counts jobs started; the final line is written after they have all
+// finished.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define PROGRESS_INTERVAL_MS 1000
+#define PROGRESS_MAX_MARKS   1024
+#define PROGRESS_SUFFIX      ".progress"
+#define PROGRESS_MAGIC       "mysh-progress 1"
+
+typedef struct {
+    off_t  offset;   // bytes of the script consumed
+    double seconds;  // time it took to get there
+} progress_mark_t;
+
+static bool     enabled;
+static bool     to_tty;
+static int      out_fd = -1;
+static char    *history_path;       // NULL if there is no script file
+static off_t    total;              // script size, or 0 if not known
+static off_t    consumed;
+static uint64_t lines;
+static uint64_t jobs;
+static struct timespec started;
+static uint64_t next_update_ms;
+
+// This run's marks, thinned out as the run gets longer: one mark every
+// mark_every updates.
+static progress_mark_t marks[PROGRESS_MAX_MARKS];
+static size_t   num_marks;
+static unsigned mark_every = 1;
+static unsigned updates;
+
+// The last complete run's marks, ending at (total, its duration).
+static progress_mark_t *past;
+static size_t           num_past;
+
+static uint64_t
+coarse_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static double
+elapsed_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - started.tv_sec) +
+           (double)(now.tv_nsec - started.tv_nsec) / 1e9;
+}
+
+static void
+free_history(void)
+{
+    free(past);
+    past = NULL;
+    num_past = 0;
+}
+
+// Read SCRIPT.progress; a missing, malformed or stale history is ignored.
+static void
+load_history(void)
+{
+    FILE *f = fopen(history_path, "r");
+    if (f == NULL) {
+        return;
+    }
+    long long size = -1;
+    if (fscanf(f, PROGRESS_MAGIC " %lld", &size) != 1 || size != (long long)total) {
+        fclose(f);
+        return;
+    }
+    past = malloc(PROGRESS_MAX_MARKS * sizeof(*past));
+    long long offset;
+    double seconds;
+    while (past != NULL && num_past < PROGRESS_MAX_MARKS &&
+           fscanf(f, "%lld %lf", &offset, &seconds) == 2) {
+        if (offset < 0 || offset > size || seconds < 0 ||
+            (num_past > 0 && (offset <= past[num_past - 1].offset ||
+                              seconds < past[num_past - 1].seconds))) {
+            break;
+        }
+        past[num_past].offset  = (off_t)offset;
+        past[num_past].seconds = seconds;
+        num_past++;
+    }
+    fclose(f);
+    // Only a history that reaches the end of the script is any use.
+    if (num_past == 0 || past[num_past - 1].offset != total) {
+        free_history();
+    }
+}
+
+// Write the history for the next run; replaced atomically, so a run that
+// is interrupted while saving leaves the previous history in place.
+static void
+save_history(double seconds)
+{
+    char tmp[4096];
+    int len = snprintf(tmp, sizeof(tmp), "%s.%ld", history_path, (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(tmp)) {
+        return;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        return;  // e.g. a read-only directory: just no history
+    }
+    fprintf(f, PROGRESS_MAGIC " %lld\n", (long long)total);
+    for (size_t i = 0; i < num_marks; i++) {
+        if (marks[i].offset < total) {
+            fprintf(f, "%lld %.3f\n", (long long)marks[i].offset, marks[i].seconds);
+        }
+    }
+    fprintf(f, "%lld %.3f\n", (long long)total, seconds);
+    if (fclose(f) != 0 || rename(tmp, history_path) != 0) {
+        unlink(tmp);
+    }
+}
+
+static void
+add_mark(double seconds)
+{
+    if (++updates % mark_every != 0) {
+        return;
+    }
+    if (num_marks > 0 && marks[num_marks - 1].offset >= consumed) {
+        return;  // nothing read since the last mark (a long job)
+    }
+    if (num_marks == PROGRESS_MAX_MARKS) {
+        // Keep every other mark and take them half as often.
+        for (size_t i = 0; i < num_marks / 2; i++) {
+            marks[i] = marks[2 * i + 1];
+        }
+        num_marks /= 2;
+        mark_every *= 2;
+    }
+    marks[num_marks].offset  = consumed;
+    marks[num_marks].seconds = seconds;
+    num_marks++;
+}
+
+// Seconds the last run took to consume offset, interpolated between marks.
+static double
+past_seconds_at(off_t offset)
+{
+    size_t lo = 0, hi = num_past;   // first mark at or past offset
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (past[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == num_past) {
+        return past[num_past - 1].seconds;
+    }
+    off_t  prev_off = lo > 0 ? past[lo - 1].offset : 0;
+    double prev_sec = lo > 0 ? past[lo - 1].seconds : 0.0;
+    double span = (double)(past[lo].offset - prev_off);
+    double frac = span > 0 ? (double)(offset - prev_off) / span : 1.0;
+    return prev_sec + frac * (past[lo].seconds - prev_sec);
+}
+
+double
+progress_eta(double elapsed, bool *from_history)
+{
+    *from_history = false;
+    if (total <= 0 || consumed <= 0) {
+        return -1.0;
+    }
+    if (consumed >= total) {
+        return 0.0;
+    }
+    if (num_past > 0) {
+        double then = past_seconds_at(consumed);
+        double left = past[num_past - 1].seconds - then;
+        // Too little of the last run to compare paces with: assume the same.
+        double pace = then >= 1.0 ? elapsed / then : 1.0;
+        *from_history = true;
+        return left * pace;
+    }
+    return elapsed * (double)(total - consumed) / (double)consumed;
+}
+
+static int
+format_bytes(char *buf, size_t size, double bytes)
+{
+    static const char *const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    size_t u = 0;
+    while (bytes >= 1024.0 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        bytes /= 1024.0;
+        u++;
+    }
+    return u == 0 ? snprintf(buf, size, "%.0f %s", bytes, units[u])
+                  : snprintf(buf, size, "%.1f %s", bytes, units[u]);
+}
+
+static int
+format_duration(char *buf, size_t size, double seconds)
+{
+    unsigned long s = seconds > 0 ? (unsigned long)(seconds + 0.5) : 0;
+    return snprintf(buf, size, "%lu:%02lu:%02lu", s / 3600, s / 60 % 60, s % 60);
+}
+
+static void
+write_report(double elapsed, bool final)
+{
+    char line[256], done[32], size[32], spent[32], eta[32];
+    format_bytes(done, sizeof(done), (double)consumed);
+    format_duration(spent, sizeof(spent), elapsed);
+
+    // A terminal gets one line redrawn in place; anything else one line
+    // per update, for a tool to follow.
+    int len = snprintf(line, sizeof(line), "%smysh: progress ", to_tty ? "\r" : "");
+    if (total > 0) {
+        format_bytes(size, sizeof(size), (double)total);
+        double pct = 100.0 * (double)consumed / (double)total;
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "%5.1f%% (%s of %s)",
+                        pct > 100.0 ? 100.0 : pct, done, size);
+    } else {
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "%s", done);
+    }
+    len += snprintf(line + len, sizeof(line) - (size_t)len,
+                    ", %llu lines, %.1f jobs/s, %s %s",
+                    (unsigned long long)lines,
+                    elapsed > 0 ? (double)jobs / elapsed : 0.0,
+                    spent, final ? "total" : "elapsed");
+
+    bool from_history;
+    double left = final ? -1.0 : progress_eta(elapsed, &from_history);
+    if (left >= 0) {
+        format_duration(eta, sizeof(eta), left);
+        len += snprintf(line + len, sizeof(line) - (size_t)len, ", ETA %s%s",
+                        eta, from_history ? " (history)" : "");
+    }
+    if ((size_t)len >= sizeof(line) - 8) {
+        len = (int)sizeof(line) - 8;
+    }
+    len += snprintf(line + len, sizeof(line) - (size_t)len, "%s",
+                    !to_tty ? "\n" : final ? "\033[K\n" : "\033[K");
+
+    struct sigaction saved;
+    ignore_sigpipe(&saved);
+
+    ssize_t n;
+    do {
+        n = write(out_fd, line, (size_t)len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        enabled = false;  // nobody is reading the progress any more
+    }
+
+    restore_sigpipe(&saved);
+}
+
+int
+progress_init(int fd, int input_fd, const char *script)
+{
+    progress_after_fork();
+    out_fd = fd;
+    to_tty = isatty(fd);
+    total = 0;
+    consumed = 0;
+    lines = 0;
+    jobs = 0;
+    num_marks = 0;
+    mark_every = 1;
+    updates = 0;
+
+    struct stat st;
+    if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        total = st.st_size;
+        off_t at = lseek(input_fd, 0, SEEK_CUR);
+        if (at > 0 && at <= total) {
+            total -= at;
+        }
+    }
+    if (script != NULL && total > 0) {
+        size_t len = strlen(script) + sizeof(PROGRESS_SUFFIX);
+        history_path = malloc(len);
+        if (history_path != NULL) {
+            snprintf(history_path, len, "%s%s", script, PROGRESS_SUFFIX);
+            load_history();
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    next_update_ms = coarse_ms() + PROGRESS_INTERVAL_MS;
+    enabled = true;
+    return 0;
+}
+
+void
+progress_jobs(size_t n)
+{
+    jobs += n;
+}
+
+void
+progress_line(size_t bytes)
+{
+    if (!enabled) {
+        return;
+    }
+    consumed += (off_t)bytes;
+    lines++;
+    uint64_t now = coarse_ms();
+    if (now < next_update_ms) {
+        return;
+    }
+    next_update_ms = now + PROGRESS_INTERVAL_MS;
+    double elapsed = elapsed_seconds();
+    add_mark(elapsed);
+    write_report(elapsed, false);
+}
+
+void
+progress_end(bool complete)
+{
+    if (!enabled) {
+        return;
+    }
+    double elapsed = elapsed_seconds();
+    write_report(elapsed, true);
+    if (complete && history_path != NULL && consumed == total) {
+        save_history(elapsed);
+    }
+    progress_after_fork();
+}
+
+void
+progress_after_fork(void)
+{
+    enabled = false;
+    free(history_path);
+    history_path = NULL;
+    free_history();
+}
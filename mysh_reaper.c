@@ -0,0 +1,439 @@
+// Child subreaper mode for mysh (--subreaper, --subreaper=kill).
+//
+// This file is responsible for:
+//   - Making mysh the PR_SET_CHILD_SUBREAPER for everything it starts, so
+//     processes a job leaves behind are reparented to mysh, not init
+//   - Working out which job each adopted process came from
+//   - Reaping adopted processes and adding their rusage to that job
+//   - Optionally killing a job's stragglers once the job itself has ended
+//   - Reporting the per-job totals when the shell exits
+//
+// Attribution: every process a job launches gets REAPER_ENV=<job id> in
+// its environment, and so does everything it forks or execs later,
+// including daemons that setsid(). When a job ends, mysh lists its own
+// children (/proc/<pid>/task/<pid>/children); any live one whose initial
+// environment (/proc/<pid>/environ) names a finished job is an orphan of
+// that job. A process that has already exited has no readable environment
+// any more. In serial mode such a zombie can only come from the job that
+// just ended, so it is charged to that job. With -j, the scheduler reaps
+// it and it counts as "unknown job".
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define REAPER_ENV        "MYSH_JOB"
+#define REAPER_LABEL_MAX  60
+#define KILL_GRACE_MS     500
+#define KILL_ROUNDS       4
+
+typedef struct {
+    char          *label;     // the job's commands, shortened
+    bool           finished;
+    size_t         reaped;    // orphans reaped
+    size_t         killed;    // stragglers signalled when the job ended
+    struct timeval utime;
+    struct timeval stime;
+} reaper_job_t;
+
+typedef struct {
+    pid_t    pid;
+    unsigned job;
+} orphan_t;
+
+static bool          enabled;
+static bool          kill_stragglers;
+static unsigned      current_job;   // tag for children launched now
+static reaper_job_t *jobs;          // indexed by id; 0 is "unknown job"
+static size_t        num_jobs;
+static size_t        cap_jobs;
+static orphan_t     *orphans;       // adopted, still running (or unreaped)
+static size_t        num_orphans;
+static size_t        cap_orphans;
+
+static int
+add_job_entry(const char *label)
+{
+    if (num_jobs == cap_jobs) {
+        size_t cap = cap_jobs ? cap_jobs * 2 : 64;
+        reaper_job_t *grown = realloc(jobs, cap * sizeof(*jobs));
+        if (grown == NULL) {
+            return -1;
+        }
+        jobs = grown;
+        cap_jobs = cap;
+    }
+    reaper_job_t *entry = &jobs[num_jobs];
+    memset(entry, 0, sizeof(*entry));
+    entry->label = malloc(strlen(label) + 1);
+    if (entry->label == NULL) {
+        return -1;
+    }
+    strcpy(entry->label, label);
+    num_jobs++;
+    return 0;
+}
+
+static orphan_t *
+find_orphan(pid_t pid)
+{
+    for (size_t i = 0; i < num_orphans; i++) {
+        if (orphans[i].pid == pid) {
+            return &orphans[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+add_orphan(pid_t pid, unsigned job)
+{
+    if (num_orphans == cap_orphans) {
+        size_t cap = cap_orphans ? cap_orphans * 2 : 16;
+        orphan_t *grown = realloc(orphans, cap * sizeof(*orphans));
+        if (grown == NULL) {
+            return;  // it is still reaped later, just as "unknown job"
+        }
+        orphans = grown;
+        cap_orphans = cap;
+    }
+    orphans[num_orphans].pid = pid;
+    orphans[num_orphans].job = job;
+    num_orphans++;
+}
+
+static void
+remove_orphan(orphan_t *orphan)
+{
+    *orphan = orphans[--num_orphans];
+}
+
+static void
+charge(unsigned job, const struct rusage *ru)
+{
+    reaper_job_t *entry = &jobs[job < num_jobs ? job : 0];
+    entry->reaped++;
+    timeradd(&entry->utime, &ru->ru_utime, &entry->utime);
+    timeradd(&entry->stime, &ru->ru_stime, &entry->stime);
+}
+
+// The job id in pid's initial environment, or 0 if there is none (or the
+// process has already exited).
+static unsigned
+read_tag(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/environ", (long)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    static char  *buf;
+    static size_t cap;
+    size_t len = 0;
+    while (true) {
+        if (len + 1 >= cap) {
+            size_t grown_cap = cap ? cap * 2 : 16384;
+            char *grown = realloc(buf, grown_cap);
+            if (grown == NULL) {
+                break;
+            }
+            buf = grown;
+            cap = grown_cap;
+        }
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fd);
+    if (buf == NULL) {
+        return 0;
+    }
+    buf[len] = '\0';
+
+    // NUL-separated NAME=VALUE entries.
+    static const char key[] = REAPER_ENV "=";
+    for (size_t i = 0; i < len; i += strlen(buf + i) + 1) {
+        if (strncmp(buf + i, key, sizeof(key) - 1) == 0) {
+            return (unsigned)strtoul(buf + i + sizeof(key) - 1, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+static bool
+is_zombie(pid_t pid)
+{
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    // "pid (comm) S ..." -- comm may contain anything, so use the last ')'.
+    char *paren = strrchr(buf, ')');
+    return paren != NULL && paren[1] == ' ' && paren[2] == 'Z';
+}
+
+// Record the children of mysh that belong to finished jobs. A zombie with
+// no readable tag is charged to fallback_job (0: leave it alone).
+static void
+adopt_children(unsigned fallback_job)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/task/%ld/children",
+             (long)getpid(), (long)getpid());
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        return;
+    }
+
+    long pid;
+    while (fscanf(f, "%ld", &pid) == 1) {
+        if (find_orphan((pid_t)pid) != NULL) {
+            continue;
+        }
+        unsigned tag = read_tag((pid_t)pid);
+        if (tag != 0) {
+            // A job still running may own it as one of its stages.
+            if (tag < num_jobs && jobs[tag].finished) {
+                add_orphan((pid_t)pid, tag);
+            }
+        } else if (fallback_job != 0 && is_zombie((pid_t)pid) &&
+                   !is_coproc_pid((pid_t)pid)) {
+            add_orphan((pid_t)pid, fallback_job);
+        }
+    }
+    fclose(f);
+}
+
+// Reap every recorded orphan that has exited.
+static void
+reap_exited(void)
+{
+    for (size_t i = 0; i < num_orphans;) {
+        int wstatus;
+        struct rusage ru;
+        pid_t pid = wait4(orphans[i].pid, &wstatus, WNOHANG, &ru);
+        if (pid > 0) {
+            flight_record(FLIGHT_REAP, pid, wstatus);
+            charge(orphans[i].job, &ru);
+            remove_orphan(&orphans[i]);
+        } else if (pid < 0 && errno == ECHILD) {
+            remove_orphan(&orphans[i]);  // reaped elsewhere
+        } else {
+            i++;
+        }
+    }
+}
+
+static size_t
+count_orphans_of(unsigned job)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < num_orphans; i++) {
+        n += orphans[i].job == job;
+    }
+    return n;
+}
+
+static void
+signal_orphans_of(unsigned job, int sig)
+{
+    for (size_t i = 0; i < num_orphans; i++) {
+        if (orphans[i].job == job) {
+            kill(orphans[i].pid, sig);
+        }
+    }
+}
+
+// SIGTERM the job's stragglers, SIGKILL whatever ignores it. Killing one
+// can orphan its own children onto us, hence the rounds.
+static void
+kill_orphans_of(unsigned job)
+{
+    for (int round = 0; round < KILL_ROUNDS; round++) {
+        size_t n = count_orphans_of(job);
+        if (n == 0) {
+            return;
+        }
+        jobs[job].killed += n;
+        signal_orphans_of(job, SIGTERM);
+
+        struct timespec tick = { 0, 10 * 1000 * 1000 };
+        for (int ms = 0; ms < KILL_GRACE_MS && count_orphans_of(job) > 0; ms += 10) {
+            nanosleep(&tick, NULL);
+            reap_exited();
+        }
+        if (count_orphans_of(job) > 0) {
+            signal_orphans_of(job, SIGKILL);
+            for (int ms = 0; ms < KILL_GRACE_MS && count_orphans_of(job) > 0; ms += 10) {
+                nanosleep(&tick, NULL);
+                reap_exited();
+            }
+        }
+        adopt_children(0);
+    }
+}
+
+int
+reaper_init(bool kill_when_done)
+{
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0) {
+        perror("prctl(PR_SET_CHILD_SUBREAPER)");
+        return -1;
+    }
+    if (add_job_entry("unknown job") < 0) {
+        perror("malloc");
+        return -1;
+    }
+    jobs[0].finished = true;
+    enabled = true;
+    kill_stragglers = kill_when_done;
+    return 0;
+}
+
+bool
+reaper_enabled(void)
+{
+    return enabled;
+}
+
+unsigned
+reaper_job_started(const job_t *job)
+{
+    if (!enabled || job == NULL || job->argvv == NULL) {
+        return 0;
+    }
+    reap_exited();
+
+    // Label: the stages' words, shortened.
+    char label[REAPER_LABEL_MAX + 4] = "";
+    size_t used = 0;
+    for (size_t i = 0; i < job->num_procs && used < REAPER_LABEL_MAX; i++) {
+        for (size_t k = 0; job->argvv[i] && job->argvv[i][k] && used < REAPER_LABEL_MAX; k++) {
+            int n = snprintf(label + used, REAPER_LABEL_MAX + 1 - used, "%s%s",
+                             (i > 0 && k == 0) ? " | " : (used ? " " : ""),
+                             job->argvv[i][k]);
+            used += (n > 0) ? (size_t)n : 0;
+        }
+    }
+    if (used >= REAPER_LABEL_MAX) {
+        strcpy(label + REAPER_LABEL_MAX, "...");
+    }
+
+    if (add_job_entry(label) < 0) {
+        return 0;
+    }
+    current_job = (unsigned)(num_jobs - 1);
+    return current_job;
+}
+
+unsigned
+reaper_current_job(void)
+{
+    return current_job;
+}
+
+void
+reaper_after_fork(void)
+{
+    // Only the shell itself is the subreaper. What a forked copy launches
+    // still carries the job's tag, so the shell accounts for it as usual.
+    enabled = false;
+}
+
+void
+reaper_tag_child(void)
+{
+    if (enabled && current_job != 0) {
+        char value[16];
+        snprintf(value, sizeof(value), "%u", current_job);
+        setenv(REAPER_ENV, value, 1);
+    }
+}
+
+void
+reaper_job_finished(unsigned job)
+{
+    if (!enabled || job == 0 || job >= num_jobs) {
+        return;
+    }
+    jobs[job].finished = true;
+
+    // With -j, zombies may be stages of running jobs: the scheduler's.
+    adopt_children(sched_enabled() ? 0 : job);
+    if (kill_stragglers) {
+        kill_orphans_of(job);
+    }
+    reap_exited();
+}
+
+void
+reaper_adopted_exit(pid_t pid, const struct rusage *ru)
+{
+    if (!enabled || is_coproc_pid(pid)) {
+        return;
+    }
+    orphan_t *orphan = find_orphan(pid);
+    charge(orphan != NULL ? orphan->job : 0, ru);
+    if (orphan != NULL) {
+        remove_orphan(orphan);
+    }
+}
+
+void
+reaper_report(FILE *out)
+{
+    if (!enabled) {
+        return;
+    }
+    adopt_children(0);
+    reap_exited();
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        reaper_job_t *entry = &jobs[i];
+        size_t running = count_orphans_of((unsigned)i);
+        if (entry->reaped == 0 && running == 0 && entry->killed == 0) {
+            continue;
+        }
+        fprintf(out, "subreaper: ");
+        if (i == 0) {
+            fprintf(out, "%s", entry->label);
+        } else {
+            fprintf(out, "job %zu (%s)", i, entry->label);
+        }
+        fprintf(out, ": %zu orphan%s reaped, user %.3fs sys %.3fs",
+                entry->reaped, entry->reaped == 1 ? "" : "s",
+                (double)entry->utime.tv_sec + (double)entry->utime.tv_usec / 1e6,
+                (double)entry->stime.tv_sec + (double)entry->stime.tv_usec / 1e6);
+        if (entry->killed > 0) {
+            fprintf(out, ", %zu killed", entry->killed);
+        }
+        if (running > 0) {
+            fprintf(out, ", %zu still running", running);
+        }
+        fputc('\n', out);
+    }
+}
@@ -0,0 +1,930 @@
+// Concurrent job scheduler for mysh.
+//
+// This file is responsible for:
+//   - Running independent jobs concurrently when mysh is started with -j N,
+//     including whole ';' / '&&' / '||' chains as single units
+//   - Per-resource-class concurrency caps (io / cpu / mem)
+//   - Collecting exit statuses only when the core loop needs them
+//   - Adaptive concurrency driven by Linux PSI and the load average
+//   - Ordered output: spooling each job's output and releasing it in
+//     script order
+//
+// Which jobs may be deferred, and when to wait, is decided by mysh_core.c;
+// process creation itself is launch_job() in mysh_cmds.c.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <time.h>
+
+#define MAX_CLASS_RULES 64
+
+// Adaptive concurrency: re-evaluate at most every ADAPT_INTERVAL_MS. Shrink
+// the limit when any PSI "some avg10" exceeds PSI_HIGH percent or the
+// 1-minute load per CPU exceeds LOAD_HIGH; grow it by one when all are below
+// the LOW marks. In between, leave it alone so it doesn't oscillate.
+#define ADAPT_INTERVAL_MS 1000
+#define PSI_HIGH          25.0
+#define PSI_LOW           10.0
+#define LOAD_HIGH         1.5
+#define LOAD_LOW          1.0
+
+// Ordered output: finished jobs whose output is waiting on an earlier job.
+// Each holds two memfds, so cap them; when full, new launches wait.
+#define MAX_PENDING_SPOOLS 256
+
+// One in-flight job.
+typedef struct {
+    bool        active;
+    unsigned long seq;              // submission order
+    pid_t       pids[MAX_COMMANDS];
+    size_t      num_procs;
+    size_t      remaining;          // children not yet reaped
+    int         status;             // exit status of the last stage
+    job_class_t jclass;
+    char       *infiles[MAX_CHAIN_JOBS];   // path_key()s, for conflict
+    char       *outfiles[MAX_CHAIN_JOBS];  // detection; one pair per job
+    size_t      num_files;
+    char      **inputs;             // path_key()s of '@in=' declarations
+    size_t      num_inputs;
+    int         spool_out;          // ordered mode: memfds, else -1
+    int         spool_err;
+    unsigned    reaper_job;         // subreaper mode: the job's id
+} sched_slot_t;
+
+// Output of a finished job, held until every earlier job has been released.
+typedef struct {
+    unsigned long seq;
+    int           spool_out;
+    int           spool_err;
+} pending_spool_t;
+
+typedef struct {
+    job_class_t jclass;
+    char       *cmd_name;
+} class_rule_t;
+
+static const char *class_names[JOB_CLASS_COUNT] = {
+    [JOB_CLASS_NONE] = "none",
+    [JOB_CLASS_IO]   = "io",
+    [JOB_CLASS_CPU]  = "cpu",
+    [JOB_CLASS_MEM]  = "mem",
+};
+
+static sched_slot_t *slots     = NULL;
+static size_t        max_slots = 0;
+static size_t        in_flight = 0;
+
+static size_t class_limit[JOB_CLASS_COUNT];     // 0 = no per-class cap
+static size_t class_in_flight[JOB_CLASS_COUNT];
+
+static class_rule_t class_rules[MAX_CLASS_RULES];
+static size_t       num_class_rules = 0;
+
+// Adaptive mode: current_limit moves between 1 and max_slots.
+static bool   adaptive      = false;
+static size_t current_limit = 0;
+static long   num_cpus      = 1;
+static struct timespec last_adapt;
+
+// Ordered mode: saved copies of the real stdout / stderr, the next job
+// (by seq) whose output may be written, and finished jobs waiting for it.
+static bool   ordered       = false;
+static int    real_stdout   = -1;
+static int    real_stderr   = -1;
+static unsigned long next_release = 1;
+static pending_spool_t pending[MAX_PENDING_SPOOLS];
+static size_t num_pending   = 0;
+
+static unsigned long next_seq    = 1;
+static unsigned long last_seq    = 0;   // most recently submitted job
+static int           last_status = 0;   // its status, once reaped
+
+static char *
+sched_strdup(const char *s)
+{
+    if (s == NULL) return NULL;
+    size_t len = strlen(s) + 1;
+    char *p = malloc(len);
+    if (p) {
+        memcpy(p, s, len);
+    }
+    return p;
+}
+
+// A file's identity for conflict checks: its canonical path, so that two
+// spellings of one file ("out.txt", "./out.txt", a symlink to it) compare
+// equal. A file that doesn't exist yet is its directory's canonical path
+// plus its name. A path that can't be resolved is kept as written.
+static char *
+path_key(const char *path)
+{
+    if (path == NULL) {
+        return NULL;
+    }
+    char *key = realpath(path, NULL);
+    if (key != NULL) {
+        return key;
+    }
+
+    char *copy = sched_strdup(path);
+    char *slash = copy != NULL ? strrchr(copy, '/') : NULL;
+    const char *name = slash != NULL ? slash + 1 : copy;
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+    char *dir = NULL;
+    if (copy != NULL && *name != '\0') {
+        dir = realpath(slash == NULL ? "." : slash == copy ? "/" : copy, NULL);
+    }
+    if (dir != NULL) {
+        size_t len = strlen(dir) + strlen(name) + 2;
+        key = malloc(len);
+        if (key != NULL) {
+            snprintf(key, len, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name);
+        }
+    }
+    free(dir);
+    free(copy);
+    return key != NULL ? key : sched_strdup(path);
+}
+
+int
+sched_init(size_t max_jobs)
+{
+    if (max_jobs < 2) {
+        return 0;  // serial execution; nothing to set up
+    }
+
+    slots = calloc(max_jobs, sizeof(*slots));
+    if (slots == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    max_slots = max_jobs;
+    current_limit = max_jobs;
+    return 0;
+}
+
+void
+sched_after_fork(void)
+{
+    // The in-flight jobs, held output and rules all belong to the parent.
+    for (size_t i = 0; i < max_slots; i++) {
+        sched_slot_t *slot = &slots[i];
+        for (size_t k = 0; k < slot->num_files; k++) {
+            free(slot->infiles[k]);
+            free(slot->outfiles[k]);
+        }
+        for (size_t k = 0; k < slot->num_inputs; k++) {
+            free(slot->inputs[k]);
+        }
+        free(slot->inputs);
+        if (slot->active && slot->spool_out >= 0) {
+            close(slot->spool_out);
+        }
+        if (slot->active && slot->spool_err >= 0) {
+            close(slot->spool_err);
+        }
+    }
+    for (size_t i = 0; i < num_pending; i++) {
+        close(pending[i].spool_out);
+        close(pending[i].spool_err);
+    }
+    for (size_t i = 0; i < num_class_rules; i++) {
+        free(class_rules[i].cmd_name);
+    }
+    if (real_stdout >= 0) {
+        close(real_stdout);
+        close(real_stderr);
+    }
+
+    free(slots);
+    slots = NULL;
+    max_slots = in_flight = current_limit = 0;
+    memset(class_limit, 0, sizeof(class_limit));
+    memset(class_in_flight, 0, sizeof(class_in_flight));
+    num_class_rules = 0;
+    adaptive = ordered = false;
+    real_stdout = real_stderr = -1;
+    num_pending = 0;
+    next_release = next_seq = 1;
+    last_seq = 0;
+    last_status = 0;
+}
+
+void
+sched_set_adaptive(bool on)
+{
+    adaptive = on && sched_enabled();
+    num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        num_cpus = 1;
+    }
+}
+
+// Read the "some avg10" figure from a /proc/pressure file.
+// Returns -1.0 if PSI is unavailable.
+static double
+read_psi_avg10(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1.0;
+    }
+    double avg10 = -1.0;
+    if (fscanf(f, "some avg10=%lf", &avg10) != 1) {
+        avg10 = -1.0;
+    }
+    fclose(f);
+    return avg10;
+}
+
+static double
+read_load_per_cpu(void)
+{
+    FILE *f = fopen("/proc/loadavg", "r");
+    if (f == NULL) {
+        return -1.0;
+    }
+    double load1 = -1.0;
+    if (fscanf(f, "%lf", &load1) != 1) {
+        load1 = -1.0;
+    }
+    fclose(f);
+    return load1 < 0 ? -1.0 : load1 / (double)num_cpus;
+}
+
+void
+sched_adapt_sample(double psi, double load)
+{
+    if (psi > PSI_HIGH || load > LOAD_HIGH) {
+        // Back off by a quarter (at least one), never below one job.
+        size_t step = current_limit / 4 > 0 ? current_limit / 4 : 1;
+        current_limit = current_limit > step ? current_limit - step : 1;
+    } else if (psi < PSI_LOW && load < LOAD_LOW) {
+        if (current_limit < max_slots) {
+            current_limit++;
+        }
+    }
+}
+
+// Recompute current_limit from system pressure (rate-limited).
+static void
+adapt_limit(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - last_adapt.tv_sec) * 1000 +
+                      (now.tv_nsec - last_adapt.tv_nsec) / 1000000;
+    if (last_adapt.tv_sec != 0 && elapsed_ms < ADAPT_INTERVAL_MS) {
+        return;
+    }
+    last_adapt = now;
+
+    static const char *psi_files[] = {
+        "/proc/pressure/cpu",
+        "/proc/pressure/memory",
+        "/proc/pressure/io",
+    };
+    double psi = -1.0;
+    for (size_t i = 0; i < sizeof(psi_files) / sizeof(psi_files[0]); i++) {
+        double v = read_psi_avg10(psi_files[i]);
+        if (v > psi) {
+            psi = v;
+        }
+    }
+    sched_adapt_sample(psi, read_load_per_cpu());
+}
+
+bool
+sched_enabled(void)
+{
+    return max_slots > 0;
+}
+
+bool
+sched_can_defer(const job_t *job)
+{
+    if (!sched_enabled() || job == NULL || job->argvv == NULL) {
+        return false;
+    }
+    if (job->bench_runs > 0 || job->perfstat) {
+        return false;  // timings are only meaningful in the foreground
+    }
+    for (size_t i = 0; i < job->num_procs; i++) {
+        if (job->argvv[i] == NULL || job->argvv[i][0] == NULL ||
+            is_builtin(job->argvv[i][0])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+sched_set_ordered(bool on)
+{
+    if (!on || !sched_enabled()) {
+        return 0;
+    }
+    real_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    real_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (real_stdout < 0 || real_stderr < 0) {
+        perror("dup");
+        return -1;
+    }
+    ordered = true;
+    return 0;
+}
+
+// Copy a spool to its real destination and close it.
+static void
+copy_spool(int spool_fd, int dest_fd)
+{
+    if (spool_fd < 0) {
+        return;
+    }
+
+    off_t offset = 0;
+    off_t size = lseek(spool_fd, 0, SEEK_END);
+    while (offset < size) {
+        ssize_t n = sendfile(dest_fd, spool_fd, &offset, (size_t)(size - offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL) {
+            break;  // e.g. an O_APPEND destination; copy by hand below
+        }
+        if (n <= 0) {
+            perror("sendfile");
+            offset = size;
+            break;
+        }
+    }
+
+    char buf[INPUT_BUFFER_SIZE];
+    while (offset < size) {
+        ssize_t n = pread(spool_fd, buf, sizeof(buf), offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t w = write(dest_fd, buf + done, (size_t)(n - done));
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                perror("write");
+                close(spool_fd);
+                return;
+            }
+            done += w;
+        }
+        offset += n;
+    }
+    close(spool_fd);
+}
+
+// Write out, in order, every spool whose predecessors have all been written.
+static void
+release_pending(void)
+{
+    bool progressed = true;
+    while (progressed) {
+        progressed = false;
+        for (size_t i = 0; i < num_pending; i++) {
+            if (pending[i].seq != next_release) {
+                continue;
+            }
+            copy_spool(pending[i].spool_out, real_stdout);
+            copy_spool(pending[i].spool_err, real_stderr);
+            pending[i] = pending[--num_pending];
+            next_release++;
+            progressed = true;
+            break;
+        }
+    }
+}
+
+static void
+release_slot(sched_slot_t *slot)
+{
+    if (slot->seq == last_seq) {
+        last_status = slot->status;
+    }
+
+    if (ordered) {
+        pending[num_pending].seq       = slot->seq;
+        pending[num_pending].spool_out = slot->spool_out;
+        pending[num_pending].spool_err = slot->spool_err;
+        num_pending++;
+        release_pending();
+    }
+
+    class_in_flight[slot->jclass]--;
+    in_flight--;
+    reaper_job_finished(slot->reaper_job);
+
+    for (size_t k = 0; k < slot->num_files; k++) {
+        free(slot->infiles[k]);
+        free(slot->outfiles[k]);
+    }
+    for (size_t k = 0; k < slot->num_inputs; k++) {
+        free(slot->inputs[k]);
+    }
+    free(slot->inputs);
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Block until one child (or native stage) of an in-flight job exits and
+// account for it.
+// Returns -1 if there is nothing left to wait for.
+static int
+reap_one(void)
+{
+    int wstatus = 0;
+    struct rusage ru;
+    pid_t pid = native_wait(-1, &wstatus, &ru);
+    if (pid == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        if (errno != ECHILD) {
+            perror("waitpid");
+        }
+        // Nothing left to reap: whatever we were tracking is gone. A '>!'
+        // output whose writer vanished unreaped is dropped, as on failure.
+        for (size_t i = 0; i < max_slots; i++) {
+            sched_slot_t *slot = &slots[i];
+            if (!slot->active) {
+                continue;
+            }
+            pid_t last = slot->num_procs > 0 ? slot->pids[slot->num_procs - 1] : 0;
+            if (last != 0) {
+                finish_atomic_output(last, W_EXITCODE(1, 0));
+            }
+            release_slot(slot);
+        }
+        return -1;
+    }
+    flight_record(FLIGHT_REAP, pid, wstatus);
+
+    if (is_coproc_pid(pid)) {
+        coproc_reaped(pid, wstatus);  // "coproc NAME" reports it
+        return 0;
+    }
+    for (size_t i = 0; i < max_slots; i++) {
+        sched_slot_t *slot = &slots[i];
+        if (!slot->active) {
+            continue;
+        }
+        for (size_t k = 0; k < slot->num_procs; k++) {
+            if (slot->pids[k] != pid) {
+                continue;
+            }
+            slot->pids[k] = 0;
+            if (k == slot->num_procs - 1) {
+                finish_atomic_output(pid, wstatus);
+                slot->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+            }
+            if (--slot->remaining == 0) {
+                release_slot(slot);
+            }
+            return 0;
+        }
+    }
+
+    // Not one of ours (e.g. a stray grandchild adopted in subreaper mode).
+    reaper_adopted_exit(pid, &ru);
+    return 0;
+}
+
+static bool
+same_path(const char *a, const char *b)
+{
+    return a != NULL && b != NULL && strcmp(a, b) == 0;
+}
+
+static bool
+writes_file(const sched_slot_t *slot, const char *key)
+{
+    for (size_t k = 0; k < slot->num_files; k++) {
+        if (same_path(slot->outfiles[k], key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+reads_file(const sched_slot_t *slot, const char *key)
+{
+    for (size_t k = 0; k < slot->num_files; k++) {
+        if (same_path(slot->infiles[k], key)) {
+            return true;
+        }
+    }
+    for (size_t k = 0; k < slot->num_inputs; k++) {
+        if (same_path(slot->inputs[k], key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The new job's files, as path_key()s: its '<' and declared '@in=' inputs
+// are reads.
+static bool
+slot_conflicts(const sched_slot_t *slot, char *const reads[], size_t num_reads,
+               const char *outfile)
+{
+    for (size_t k = 0; k < num_reads; k++) {
+        if (writes_file(slot, reads[k])) {      // read after write
+            return true;
+        }
+    }
+    return writes_file(slot, outfile) ||        // write after write
+           reads_file(slot, outfile);           // write after read
+}
+
+void
+sched_wait_conflicts(const job_t *job)
+{
+    if (!sched_enabled() || job == NULL ||
+        (job->infile == NULL && job->outfile == NULL && job->inputs == NULL)) {
+        return;
+    }
+
+    size_t num_inputs = 0;
+    while (job->inputs != NULL && job->inputs[num_inputs] != NULL) {
+        num_inputs++;
+    }
+    char *reads[num_inputs + 1];
+    size_t num_reads = 0;
+    if (job->infile != NULL) {
+        reads[num_reads++] = path_key(job->infile);
+    }
+    for (size_t k = 0; k < num_inputs; k++) {
+        reads[num_reads++] = path_key(job->inputs[k]);
+    }
+    char *outfile = path_key(job->outfile);
+
+    for (size_t i = 0; i < max_slots; i++) {
+        while (slots[i].active &&
+               slot_conflicts(&slots[i], reads, num_reads, outfile)) {
+            if (reap_one() < 0) {
+                break;
+            }
+        }
+    }
+    for (size_t k = 0; k < num_reads; k++) {
+        free(reads[k]);
+    }
+    free(outfile);
+}
+
+static bool
+has_room(job_class_t jclass)
+{
+    if (adaptive) {
+        adapt_limit();
+    }
+    if (in_flight >= current_limit) {
+        return false;
+    }
+    if (ordered && in_flight + num_pending >= MAX_PENDING_SPOOLS) {
+        return false;
+    }
+    if (class_limit[jclass] != 0 && class_in_flight[jclass] >= class_limit[jclass]) {
+        return false;
+    }
+    return true;
+}
+
+// Create a slot's memfd spools and point the shell's stdout / stderr at
+// them so the job's children inherit them.
+static int
+open_spools(sched_slot_t *slot)
+{
+    slot->spool_out = memfd_create("mysh-stdout", MFD_CLOEXEC);
+    slot->spool_err = memfd_create("mysh-stderr", MFD_CLOEXEC);
+    if (slot->spool_out < 0 || slot->spool_err < 0) {
+        perror("memfd_create");
+        goto fail;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    if (dup2(slot->spool_out, STDOUT_FILENO) < 0 ||
+        dup2(slot->spool_err, STDERR_FILENO) < 0) {
+        perror("dup2");
+        dup2(real_stdout, STDOUT_FILENO);
+        dup2(real_stderr, STDERR_FILENO);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (slot->spool_out >= 0) close(slot->spool_out);
+    if (slot->spool_err >= 0) close(slot->spool_err);
+    slot->spool_out = -1;
+    slot->spool_err = -1;
+    return -1;
+}
+
+// Wait for room in jclass and claim a free slot, pointing stdout / stderr
+// at its spools in ordered mode. Returns NULL if no slot could be had.
+static sched_slot_t *
+claim_slot(job_class_t jclass)
+{
+    while (!has_room(jclass)) {
+        if (reap_one() < 0) {
+            break;
+        }
+    }
+
+    sched_slot_t *slot = NULL;
+    for (size_t i = 0; i < max_slots; i++) {
+        if (!slots[i].active) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    slot->spool_out = -1;
+    slot->spool_err = -1;
+    if (ordered && open_spools(slot) < 0) {
+        return NULL;
+    }
+    return slot;
+}
+
+// Second half of a submission: rc is the launch's result (< 0: failed). On
+// success the slot becomes active with num_procs pids still to reap; the
+// caller then records the files it uses.
+static int
+activate_slot(sched_slot_t *slot, int rc, size_t num_procs, job_class_t jclass)
+{
+    if (ordered) {
+        // Put the real stdout / stderr back for the shell itself.
+        fflush(stderr);
+        dup2(real_stdout, STDOUT_FILENO);
+        dup2(real_stderr, STDERR_FILENO);
+    }
+    if (rc < 0) {
+        if (ordered) {
+            close(slot->spool_out);
+            close(slot->spool_err);
+        }
+        memset(slot, 0, sizeof(*slot));
+        return -1;
+    }
+
+    slot->active    = true;
+    slot->seq       = next_seq++;
+    slot->num_procs = num_procs;
+    slot->remaining = num_procs;
+    slot->status    = 1;
+    slot->jclass    = jclass;
+    slot->reaper_job = reaper_current_job();
+
+    in_flight++;
+    class_in_flight[jclass]++;
+    last_seq = slot->seq;
+    return 0;
+}
+
+static void
+add_slot_files(sched_slot_t *slot, const job_t *job)
+{
+    slot->infiles[slot->num_files]  = path_key(job->infile);
+    slot->outfiles[slot->num_files] = path_key(job->outfile);
+    slot->num_files++;
+
+    size_t n = 0;
+    while (job->inputs != NULL && job->inputs[n] != NULL) {
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+    char **grown = realloc(slot->inputs, (slot->num_inputs + n) * sizeof(*grown));
+    if (grown == NULL) {
+        perror("realloc");  // later writers of these inputs won't wait
+        return;
+    }
+    slot->inputs = grown;
+    for (size_t k = 0; k < n; k++) {
+        char *key = path_key(job->inputs[k]);
+        if (key != NULL) {
+            slot->inputs[slot->num_inputs++] = key;
+        }
+    }
+}
+
+int
+sched_submit(const job_t *job, bool input_is_tty)
+{
+    if (!sched_enabled() || job == NULL || job->num_procs > MAX_COMMANDS) {
+        return -1;
+    }
+
+    job_class_t jclass = sched_class_of(job);
+    sched_slot_t *slot = claim_slot(jclass);
+    if (slot == NULL) {
+        return -1;
+    }
+
+    // Fused native stages share a pid, so there may be fewer than stages.
+    int num_pids = launch_job(job, input_is_tty, slot->pids);
+    if (activate_slot(slot, num_pids, num_pids < 0 ? 0 : (size_t)num_pids,
+                      jclass) < 0) {
+        return -1;
+    }
+    add_slot_files(slot, job);
+    return 0;
+}
+
+bool
+sched_can_defer_chain(const chain_t *chain)
+{
+    if (chain == NULL || chain->num_jobs == 0 ||
+        chain->num_jobs > MAX_CHAIN_JOBS) {
+        return false;
+    }
+    for (size_t i = 0; i < chain->num_jobs; i++) {
+        if (!sched_can_defer(&chain->jobs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+sched_submit_chain(const chain_t *chain, int status, bool input_is_tty)
+{
+    if (!sched_can_defer_chain(chain)) {
+        return -1;
+    }
+
+    job_class_t jclass = JOB_CLASS_NONE;
+    for (size_t i = 0; i < chain->num_jobs && jclass == JOB_CLASS_NONE; i++) {
+        jclass = sched_class_of(&chain->jobs[i]);
+    }
+    sched_slot_t *slot = claim_slot(jclass);
+    if (slot == NULL) {
+        return -1;
+    }
+
+    // The chain is one process to the scheduler, whatever it runs.
+    int rc = launch_chain(chain, status, input_is_tty, &slot->pids[0]);
+    if (activate_slot(slot, rc, 1, jclass) < 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < chain->num_jobs; i++) {
+        add_slot_files(slot, &chain->jobs[i]);
+    }
+    return 0;
+}
+
+static bool
+seq_in_flight(unsigned long seq)
+{
+    for (size_t i = 0; i < max_slots; i++) {
+        if (slots[i].active && slots[i].seq == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t
+sched_current_limit(void)
+{
+    return current_limit;
+}
+
+int
+sched_wait_last(void)
+{
+    if (!sched_enabled()) {
+        return last_status;
+    }
+    while (seq_in_flight(last_seq)) {
+        if (reap_one() < 0) {
+            break;
+        }
+    }
+    return last_status;
+}
+
+void
+sched_flush_output(void)
+{
+    if (ordered) {
+        sched_drain();
+        fflush(stdout);
+    }
+}
+
+int
+sched_drain(void)
+{
+    if (!sched_enabled()) {
+        return last_status;
+    }
+    while (in_flight > 0) {
+        if (reap_one() < 0) {
+            break;
+        }
+    }
+    return last_status;
+}
+
+int
+sched_class_from_name(const char *name, job_class_t *out)
+{
+    for (int c = JOB_CLASS_NONE + 1; c < JOB_CLASS_COUNT; c++) {
+        if (strcmp(name, class_names[c]) == 0) {
+            *out = (job_class_t)c;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void
+sched_set_class_limit(job_class_t jclass, size_t limit)
+{
+    if (jclass > JOB_CLASS_NONE && jclass < JOB_CLASS_COUNT) {
+        class_limit[jclass] = limit;
+    }
+}
+
+int
+sched_add_class_rule(job_class_t jclass, const char *cmd_name)
+{
+    for (size_t i = 0; i < num_class_rules; i++) {
+        if (strcmp(class_rules[i].cmd_name, cmd_name) == 0) {
+            class_rules[i].jclass = jclass;
+            return 0;
+        }
+    }
+    if (num_class_rules >= MAX_CLASS_RULES) {
+        return -1;
+    }
+
+    char *copy = sched_strdup(cmd_name);
+    if (copy == NULL) {
+        return -1;
+    }
+    class_rules[num_class_rules].jclass   = jclass;
+    class_rules[num_class_rules].cmd_name = copy;
+    num_class_rules++;
+    return 0;
+}
+
+// An explicit @class wins; otherwise the first stage whose command name
+// (ignoring any directory part) matches a rule decides.
+job_class_t
+sched_class_of(const job_t *job)
+{
+    if (job->jclass != JOB_CLASS_NONE) {
+        return job->jclass;
+    }
+
+    for (size_t i = 0; i < job->num_procs; i++) {
+        if (job->argvv[i] == NULL || job->argvv[i][0] == NULL) {
+            continue;
+        }
+        const char *name = job->argvv[i][0];
+        const char *slash = strrchr(name, '/');
+        if (slash != NULL) {
+            name = slash + 1;
+        }
+        for (size_t r = 0; r < num_class_rules; r++) {
+            if (strcmp(class_rules[r].cmd_name, name) == 0) {
+                return class_rules[r].jclass;
+            }
+        }
+    }
+    return JOB_CLASS_NONE;
+}
@@ -0,0 +1,317 @@
+// Shared-memory ring targets for mysh ("> @shm:NAME", "< @shm:NAME").
+//
+// This file is responsible for:
+//   - Creating / attaching the POSIX shared-memory ring /dev/shm/mysh.NAME
+//   - Pumping a job's stdout into the ring, or the ring into a job's stdin
+//
+// The ring layout is shm_ring_t in mysh.h, so a long-lived service can map
+// it and consume output without touching the filesystem. It is one
+// producer, one consumer: head and tail only ever grow, the producer
+// publishes head with a release store after copying data in, and the
+// consumer publishes tail the same way after copying data out. Either side
+// that runs out of data / space sleeps on the other side's futex word.
+//
+// A job can't write into the mapping directly, so its stdout is a pipe and
+// a pump process copies from the pipe into the ring (and the other way for
+// '<'). The pump is double-forked so nobody has to reap it; it exits when
+// the job closes its end of the pipe (or, reading, when the ring hits EOF
+// and is drained, or the job stops reading). It closes every other fd it
+// inherited, so it never keeps another pipe -- another pump's, or the
+// shell's stdout -- open after its owner is done with it.
+//
+// Writers take turns: a new writer takes an flock() on the ring before it
+// clears eof, and its pump holds that lock until it has set eof again. A
+// second "> @shm:NAME" opened meanwhile waits for the first writer's
+// output to be in the ring instead of pumping into it at the same time.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+#define SHM_PREFIX      "@shm:"
+#define SHM_DATA_OFFSET 4096
+#define PUMP_CHUNK      65536
+
+static void
+futex_wait(uint32_t *word, uint32_t seen)
+{
+    // Bounded, so a peer that died without waking us can't hang the pump.
+    struct timespec timeout = { 0, 100 * 1000 * 1000 };
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+}
+
+static void
+futex_bump(uint32_t *word)
+{
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Map the ring for NAME, creating it on first use. If fd_out is not NULL
+// the shm fd is left open there (for the producer lock), else closed.
+static shm_ring_t *
+attach_ring(const char *name, int *fd_out)
+{
+    char shm_name[NAME_MAX];
+    if (name[0] == '\0' || strchr(name, '/') != NULL ||
+        snprintf(shm_name, sizeof(shm_name), "/mysh.%s", name) >= (int)sizeof(shm_name)) {
+        fprintf(stderr, "%s%s: invalid ring name\n", SHM_PREFIX, name);
+        return NULL;
+    }
+    size_t size = SHM_DATA_OFFSET + SHM_RING_CAPACITY;
+
+    bool created = true;
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(shm_name, O_RDWR | O_CLOEXEC, 0600);
+    }
+    if (fd < 0 || (created && ftruncate(fd, (off_t)size) < 0)) {
+        perror(shm_name);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    shm_ring_t *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror(shm_name);
+        close(fd);
+        return NULL;
+    }
+
+    if (created) {
+        ring->version     = SHM_RING_VERSION;
+        ring->data_offset = SHM_DATA_OFFSET;
+        ring->capacity    = SHM_RING_CAPACITY;
+        // Magic last: an attacher that sees it sees an initialized header.
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(ring->magic, SHM_RING_MAGIC, sizeof(ring->magic));
+    } else {
+        bool ok = true;
+        for (int tries = 0;
+             memcmp((const char *)ring->magic, SHM_RING_MAGIC, sizeof(ring->magic)) != 0;
+             tries++) {
+            if (tries == 100) {
+                fprintf(stderr, "%s%s: not a mysh ring\n", SHM_PREFIX, name);
+                ok = false;
+                break;
+            }
+            usleep(1000);
+        }
+        if (ok && (ring->version != SHM_RING_VERSION || ring->capacity != SHM_RING_CAPACITY)) {
+            fprintf(stderr, "%s%s: ring has another layout\n", SHM_PREFIX, name);
+            ok = false;
+        }
+        if (!ok) {
+            munmap(ring, size);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    if (fd_out != NULL) {
+        *fd_out = fd;
+    } else {
+        close(fd);
+    }
+    return ring;
+}
+
+// Producer: copy everything from fd into the ring, then mark EOF.
+static void
+pump_into_ring(shm_ring_t *ring, int fd)
+{
+    unsigned char *data = (unsigned char *)ring + ring->data_offset;
+    uint64_t mask = ring->capacity - 1;
+    static unsigned char buf[PUMP_CHUNK];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        size_t off = 0;
+        while (off < (size_t)n) {
+            uint64_t head = ring->head;  // only we write it
+            uint32_t seen = __atomic_load_n(&ring->space_futex, __ATOMIC_ACQUIRE);
+            uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            uint64_t space = ring->capacity - (head - tail);
+            if (space == 0) {
+                futex_wait(&ring->space_futex, seen);
+                continue;
+            }
+
+            size_t len = (size_t)n - off;
+            if (len > space) {
+                len = space;
+            }
+            size_t at = head & mask;
+            size_t first = len < ring->capacity - at ? len : ring->capacity - at;
+            memcpy(data + at, buf + off, first);
+            memcpy(data, buf + off + first, len - first);
+
+            __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+            futex_bump(&ring->data_futex);
+            off += len;
+        }
+    }
+
+    __atomic_store_n(&ring->eof, 1, __ATOMIC_RELEASE);
+    futex_bump(&ring->data_futex);
+}
+
+// Consumer: copy from the ring to fd until EOF is set and the ring drained.
+static void
+pump_from_ring(shm_ring_t *ring, int fd)
+{
+    const unsigned char *data = (const unsigned char *)ring + ring->data_offset;
+    uint64_t mask = ring->capacity - 1;
+
+    while (true) {
+        uint32_t seen = __atomic_load_n(&ring->data_futex, __ATOMIC_ACQUIRE);
+        uint32_t eof  = __atomic_load_n(&ring->eof, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;  // only we write it
+        if (head == tail) {
+            if (eof) {
+                return;
+            }
+            // With no writer the ring may never reach EOF; stop once the
+            // job has exited or closed its stdin.
+            struct pollfd pfd = { .fd = fd, .events = 0 };
+            if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+                return;
+            }
+            futex_wait(&ring->data_futex, seen);
+            continue;
+        }
+
+        size_t at = tail & mask;
+        size_t len = head - tail;
+        if (len > ring->capacity - at) {
+            len = ring->capacity - at;  // up to the wrap; the rest next round
+        }
+        ssize_t n = write(fd, data + at, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;  // reader went away
+        }
+        __atomic_store_n(&ring->tail, tail + (uint64_t)n, __ATOMIC_RELEASE);
+        futex_bump(&ring->space_futex);
+    }
+}
+
+// In the pump: close every fd but stderr and the two it needs.
+static void
+close_other_fds(int keep, int keep2)
+{
+    DIR *d = opendir("/proc/self/fd");
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        int fd = atoi(ent->d_name);
+        if (ent->d_name[0] != '.' && fd != dirfd(d) && fd != STDERR_FILENO &&
+            fd != keep && fd != keep2) {
+            close(fd);
+        }
+    }
+    closedir(d);
+}
+
+int
+open_shm_target(const char *path, bool for_output)
+{
+    if (strncmp(path, SHM_PREFIX, strlen(SHM_PREFIX)) != 0) {
+        return -1;
+    }
+
+    int lock_fd = -1;
+    shm_ring_t *ring = attach_ring(path + strlen(SHM_PREFIX), for_output ? &lock_fd : NULL);
+    if (ring == NULL) {
+        return -2;
+    }
+    if (for_output) {
+        // Wait for an earlier writer's pump to finish, then start a new
+        // stream: readers from now on wait for its EOF, not an old one.
+        // The pump inherits the lock and holds it until it sets eof.
+        while (flock(lock_fd, LOCK_EX) < 0 && errno == EINTR) {
+        }
+        __atomic_store_n(&ring->eof, 0, __ATOMIC_RELEASE);
+    }
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("pipe");
+        munmap(ring, ring->data_offset + ring->capacity);
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        return -2;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(p[0]);
+        close(p[1]);
+        munmap(ring, ring->data_offset + ring->capacity);
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        return -2;
+    }
+    if (pid == 0) {
+        // Intermediate child: start the pump and exit, so the pump is
+        // reparented and never needs reaping.
+        if (fork() == 0) {
+            signal(SIGPIPE, SIG_IGN);
+            close_other_fds(for_output ? p[0] : p[1], lock_fd);
+            if (for_output) {
+                pump_into_ring(ring, p[0]);
+                flock(lock_fd, LOCK_UN);  // eof is set: the next writer's turn
+            } else {
+                pump_from_ring(ring, p[1]);
+            }
+            _exit(0);
+        }
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    munmap(ring, ring->data_offset + ring->capacity);
+    if (lock_fd >= 0) {
+        close(lock_fd);  // the pump's copy keeps the lock
+    }
+
+    if (for_output) {
+        close(p[0]);
+        return p[1];
+    }
+    close(p[1]);
+    return p[0];
+}
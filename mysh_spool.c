@@ -0,0 +1,304 @@
+// Spool-directory job queue consumer for mysh (--spool DIR).
+//
+// This file is responsible for:
+//   - Noticing job files dropped into DIR (inotify, plus a scan at startup)
+//   - Claiming each one atomically by renaming it into DIR/claimed/
+//   - Running up to N of them at once, each in a forked copy of the shell
+//   - Writing DIR/done/NAME.out, NAME.err and NAME.status, then moving the
+//     job file itself to DIR/done/
+//
+// A job file is any regular file in DIR whose name ends in ".job" and does
+// not start with '.'; it is run like a script passed on the command line.
+// Producers should write the file elsewhere (or under a dot name) and
+// rename it into DIR, so it is never seen half-written. Because the claim
+// is a rename() within DIR, several consumers can share one directory: for
+// each file exactly one rename succeeds and the others get ENOENT.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define JOB_SUFFIX ".job"
+
+typedef struct {
+    pid_t pid;
+    char  name[NAME_MAX + 1];
+} spool_child_t;
+
+static const char *spool_dir;
+static spool_child_t *children;
+static size_t max_children;
+static size_t num_children;
+
+bool
+spool_is_job_name(const char *name)
+{
+    size_t len = strlen(name);
+    size_t suffix = strlen(JOB_SUFFIX);
+    return name[0] != '.' && len > suffix &&
+           strcmp(name + len - suffix, JOB_SUFFIX) == 0;
+}
+
+static void
+spool_path(char *buf, const char *sub, const char *name, const char *ext)
+{
+    snprintf(buf, PATH_MAX, "%s/%s%s%s%s", spool_dir,
+             sub ? sub : "", sub ? "/" : "", name, ext ? ext : "");
+}
+
+// Write DIR/done/NAME.status via a temporary name so readers never see a
+// partial status.
+static void
+write_status(const char *name, int status)
+{
+    char tmp[PATH_MAX], final[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/done/.%s.status", spool_dir, name);
+    spool_path(final, "done", name, ".status");
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        perror(tmp);
+        return;
+    }
+    dprintf(fd, "%d\n", status);
+    close(fd);
+    if (rename(tmp, final) < 0) {
+        perror(final);
+    }
+}
+
+// Child side: run the claimed job file with its output in DIR/done/.
+static void
+run_claimed(const char *name, const sigset_t *old_mask)
+{
+    char job_path[PATH_MAX], out[PATH_MAX], err[PATH_MAX];
+    spool_path(job_path, "claimed", name, NULL);
+    spool_path(out, "done", name, ".out");
+    spool_path(err, "done", name, ".err");
+
+    sigprocmask(SIG_SETMASK, old_mask, NULL);
+
+    int in_fd  = open(job_path, O_RDONLY);
+    int null_fd = open("/dev/null", O_RDONLY);
+    int out_fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    int err_fd = open(err, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (in_fd < 0 || null_fd < 0 || out_fd < 0 || err_fd < 0 ||
+        dup2(null_fd, STDIN_FILENO) < 0 ||
+        dup2(out_fd, STDOUT_FILENO) < 0 ||
+        dup2(err_fd, STDERR_FILENO) < 0) {
+        perror(name);
+        _exit(EXIT_FAILURE);
+    }
+    close(null_fd);
+    close(out_fd);
+    close(err_fd);
+
+    int status = read_and_execute_loop(in_fd);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+int
+spool_claim(const char *name)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    spool_path(from, NULL, name, NULL);
+    spool_path(to, "claimed", name, NULL);
+
+    if (rename(from, to) < 0) {
+        if (errno != ENOENT) {
+            perror(from);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void
+spool_finish(const char *name, int status)
+{
+    write_status(name, status);
+
+    char from[PATH_MAX], to[PATH_MAX];
+    spool_path(from, "claimed", name, NULL);
+    spool_path(to, "done", name, NULL);
+    if (rename(from, to) < 0) {
+        perror(from);
+    }
+}
+
+// Try to claim DIR/name and start it. Returns 0 if started, -1 if the file
+// was claimed by someone else or could not be started.
+static int
+claim_and_start(const char *name, const sigset_t *old_mask)
+{
+    if (spool_claim(name) < 0) {
+        return -1;
+    }
+
+    char from[PATH_MAX], to[PATH_MAX];
+    spool_path(from, NULL, name, NULL);
+    spool_path(to, "claimed", name, NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        rename(to, from);  // give it back to the queue
+        return -1;
+    }
+    if (pid == 0) {
+        run_claimed(name, old_mask);
+    }
+
+    spool_child_t *c = &children[num_children++];
+    c->pid = pid;
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    return 0;
+}
+
+// True if a directory entry is a regular file. Filesystems that leave
+// d_type as DT_UNKNOWN get an lstat(), so a directory or symlink named
+// "x.job" is never claimed.
+static bool
+is_regular_entry(DIR *d, const struct dirent *ent)
+{
+    if (ent->d_type != DT_UNKNOWN) {
+        return ent->d_type == DT_REG;
+    }
+    struct stat st;
+    return fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+           S_ISREG(st.st_mode);
+}
+
+// Start as many queued job files as there are free slots.
+static void
+fill_slots(const sigset_t *old_mask)
+{
+    if (num_children >= max_children) {
+        return;
+    }
+
+    DIR *d = opendir(spool_dir);
+    if (d == NULL) {
+        perror(spool_dir);
+        return;
+    }
+
+    struct dirent *ent;
+    while (num_children < max_children && (ent = readdir(d)) != NULL) {
+        if (spool_is_job_name(ent->d_name) && is_regular_entry(d, ent)) {
+            claim_and_start(ent->d_name, old_mask);
+        }
+    }
+    closedir(d);
+}
+
+// Record results for every child that has exited.
+static void
+reap_children(void)
+{
+    int wstatus;
+    pid_t pid;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+        for (size_t i = 0; i < num_children; i++) {
+            if (children[i].pid != pid) {
+                continue;
+            }
+
+            int status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                                            : 128 + WTERMSIG(wstatus);
+            spool_finish(children[i].name, status);
+            children[i] = children[--num_children];
+            break;
+        }
+    }
+}
+
+int
+spool_prepare(const char *dir)
+{
+    spool_dir = dir;
+
+    char sub[PATH_MAX];
+    static const char *subdirs[] = { "claimed", "done" };
+    for (size_t i = 0; i < 2; i++) {
+        snprintf(sub, sizeof(sub), "%s/%s", dir, subdirs[i]);
+        if (mkdir(sub, 0750) < 0 && errno != EEXIST) {
+            perror(sub);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+spool_consume(const char *dir, size_t max_jobs)
+{
+    max_children = max_jobs > 0 ? max_jobs : 1;
+    children = calloc(max_children, sizeof(*children));
+    if (children == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    if (spool_prepare(dir) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Child exits arrive on a signalfd so one poll() covers both sources.
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+    int sig_fd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    int in_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (sig_fd < 0 || in_fd < 0 ||
+        inotify_add_watch(in_fd, dir, IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+
+    // Pick up anything queued before we started.
+    fill_slots(&old_mask);
+
+    struct pollfd fds[2] = {
+        { .fd = in_fd,  .events = POLLIN },
+        { .fd = sig_fd, .events = POLLIN },
+    };
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // Drain both fds; the directory scan below finds the actual work.
+        while (read(in_fd, buf, sizeof(buf)) > 0) {
+        }
+        while (read(sig_fd, buf, sizeof(buf)) > 0) {
+        }
+
+        reap_children();
+        fill_slots(&old_mask);
+    }
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,590 @@
+// Watch mode for mysh (--watch).
+//
+// This file is responsible for:
+//   - Loading a script into parsed jobs, with the files each job reads
+//     (infile and '@in=' declarations) and writes (outfile)
+//   - Watching those files and the script itself with inotify
+//   - Re-running only the jobs a change affects: the jobs reading the
+//     changed file, the and/or (or &&/||) jobs chained after them, and
+//     (transitively) jobs reading what a re-run job writes
+//
+// Files are keyed by their canonical directory plus base name, relative to
+// the directory mysh was started in. We watch directories rather than files
+// so editors that save by rename are noticed.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS   (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+#define DEBOUNCE_MS    100
+
+typedef struct {
+    job_t  job;
+    int    parse_status;
+    int    cond_status;    // status its conditional saw on the last run
+    bool   affected;
+    bool   ran;            // in the last pass
+    char **in_keys;        // NULL-terminated
+    char  *out_key;
+} watch_job_t;
+
+typedef struct {
+    int   wd;
+    char *dir;
+} watch_dir_t;
+
+// Changed keys a pass has yet to act on, without duplicates.
+typedef struct {
+    char  **keys;
+    size_t  num;
+    size_t  cap;
+} change_set_t;
+
+static watch_job_t *jobs     = NULL;
+static size_t       num_jobs = 0;
+static char        *script_key = NULL;
+
+static watch_dir_t *dirs     = NULL;
+static size_t       num_dirs = 0;
+
+static int inotify_fd = -1;
+
+// Canonical key for a path: realpath() of its directory + "/" + base name.
+static char *
+path_key(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    const char *base  = slash ? slash + 1 : path;
+    char dir[PATH_MAX];
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        size_t len = (size_t)(slash - path);
+        if (len >= sizeof(dir)) {
+            return NULL;
+        }
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    char real[PATH_MAX];
+    const char *d = realpath(dir, real) ? real : dir;
+    size_t len = strlen(d) + 1 + strlen(base) + 1;
+    char *key = malloc(len);
+    if (key) {
+        snprintf(key, len, "%s/%s", strcmp(d, "/") == 0 ? "" : d, base);
+    }
+    return key;
+}
+
+// Watch the directory of a key (keys always contain a '/').
+static void
+watch_key_dir(const char *key)
+{
+    const char *slash = strrchr(key, '/');
+    size_t len = (size_t)(slash - key);
+    char *dir = malloc(len + 2);
+    if (dir == NULL) {
+        return;
+    }
+    if (len == 0) {
+        strcpy(dir, "/");
+    } else {
+        memcpy(dir, key, len);
+        dir[len] = '\0';
+    }
+
+    for (size_t i = 0; i < num_dirs; i++) {
+        if (strcmp(dirs[i].dir, dir) == 0) {
+            free(dir);
+            return;
+        }
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir, WATCH_EVENTS);
+    if (wd < 0) {
+        perror(dir);
+        free(dir);
+        return;
+    }
+
+    watch_dir_t *grown = realloc(dirs, (num_dirs + 1) * sizeof(*dirs));
+    if (grown == NULL) {
+        inotify_rm_watch(inotify_fd, wd);
+        free(dir);
+        return;
+    }
+    dirs = grown;
+    dirs[num_dirs].wd  = wd;
+    dirs[num_dirs].dir = dir;
+    num_dirs++;
+}
+
+static void
+unload_script(void)
+{
+    for (size_t i = 0; i < num_jobs; i++) {
+        free_job(&jobs[i].job);
+        if (jobs[i].in_keys) {
+            for (size_t k = 0; jobs[i].in_keys[k] != NULL; k++) {
+                free(jobs[i].in_keys[k]);
+            }
+            free(jobs[i].in_keys);
+        }
+        free(jobs[i].out_key);
+    }
+    free(jobs);
+    jobs = NULL;
+    num_jobs = 0;
+
+    for (size_t i = 0; i < num_dirs; i++) {
+        inotify_rm_watch(inotify_fd, dirs[i].wd);
+        free(dirs[i].dir);
+    }
+    free(dirs);
+    dirs = NULL;
+    num_dirs = 0;
+}
+
+// Compute a job's file keys and watch the directories they live in.
+static int
+index_job(watch_job_t *wj)
+{
+    const job_t *job = &wj->job;
+    size_t n = (job->infile != NULL) ? 1 : 0;
+    for (size_t i = 0; job->inputs && job->inputs[i] != NULL; i++) {
+        n++;
+    }
+
+    wj->in_keys = calloc(n + 1, sizeof(char *));
+    if (wj->in_keys == NULL) {
+        return -1;
+    }
+
+    size_t k = 0;
+    if (job->infile) {
+        wj->in_keys[k++] = path_key(job->infile);
+    }
+    for (size_t i = 0; job->inputs && job->inputs[i] != NULL; i++) {
+        wj->in_keys[k++] = path_key(job->inputs[i]);
+    }
+    for (size_t i = 0; i < k; i++) {
+        if (wj->in_keys[i] == NULL) {
+            return -1;
+        }
+        watch_key_dir(wj->in_keys[i]);
+    }
+
+    if (job->outfile) {
+        wj->out_key = path_key(job->outfile);
+        if (wj->out_key == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Read and parse the whole script, one watch_job_t per non-empty line.
+static int
+load_script(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        print_mysh_error(path, strerror(errno));
+        return -1;
+    }
+
+    size_t cap = INPUT_BUFFER_SIZE, len = 0;
+    char *text = malloc(cap);
+    while (text != NULL) {
+        if (len + 1 >= cap) {
+            char *grown = realloc(text, cap * 2);
+            if (grown == NULL) {
+                free(text);
+                text = NULL;
+                break;
+            }
+            text = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, text + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fd);
+    if (text == NULL) {
+        print_mysh_error("malloc", "failed to read script");
+        return -1;
+    }
+    text[len] = '\0';
+
+    // At most one job per line plus one per ';', '&&' or '||'.
+    size_t max_jobs = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n' || text[i] == ';' || text[i] == '&' || text[i] == '|') {
+            max_jobs++;
+        }
+    }
+    jobs = calloc(max_jobs, sizeof(*jobs));
+    if (jobs == NULL) {
+        free(text);
+        return -1;
+    }
+
+    char *line = text;
+    while (line != NULL && *line != '\0') {
+        char *nl = strchr(line, '\n');
+        if (nl) {
+            *nl = '\0';
+        }
+
+        // A chain's jobs become consecutive jobs; their conditionals
+        // already say what each one depends on.
+        chain_t chain = (chain_t){0};
+        int parse_status = parse_chain(line, &chain);
+        if (parse_status < 0) {
+            jobs[num_jobs++].parse_status = parse_status;
+        }
+        for (size_t k = 0; parse_status > 0 && k < chain.num_jobs; k++) {
+            watch_job_t *wj = &jobs[num_jobs++];
+            wj->parse_status = parse_status;
+            wj->job = chain.jobs[k];
+            chain.jobs[k] = (job_t){0};
+            if (index_job(wj) < 0) {
+                print_mysh_error("watch", "failed to index job");
+            }
+        }
+        free_chain(&chain);
+
+        line = nl ? nl + 1 : NULL;
+    }
+    free(text);
+
+    free(script_key);
+    script_key = path_key(path);
+    if (script_key != NULL) {
+        watch_key_dir(script_key);
+    }
+    return 0;
+}
+
+// Run every job (all == true) or only the affected ones. A chain resumed
+// in the middle sees the status its conditional saw on the previous run.
+static void
+run_jobs(bool all)
+{
+    size_t last_run = (size_t)-1;
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].ran = false;
+    }
+    for (size_t i = 0; i < num_jobs; i++) {
+        watch_job_t *wj = &jobs[i];
+        if (!all && !wj->affected) {
+            continue;
+        }
+        wj->ran = true;
+
+        if (!all && wj->job.cond != COND_NONE && last_run + 1 != i) {
+            resume_with_status(wj->cond_status);
+        }
+        last_run = i;
+
+        if (run_parsed_job(&wj->job, wj->parse_status, &wj->cond_status) >= 0) {
+            // exit / die ends this pass, not the watch.
+            break;
+        }
+    }
+    finish_pending_jobs();
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].affected = false;
+    }
+}
+
+static bool
+job_reads(const watch_job_t *wj, const char *key)
+{
+    for (size_t k = 0; wj->in_keys && wj->in_keys[k] != NULL; k++) {
+        if (strcmp(wj->in_keys[k], key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Mark jobs reading key, then propagate in script order to and/or chains
+// and to jobs reading an affected job's output. Returns the count marked.
+static size_t
+mark_affected(char *const *keys, size_t num_keys)
+{
+    for (size_t i = 0; i < num_jobs; i++) {
+        for (size_t k = 0; k < num_keys; k++) {
+            if (jobs[i].parse_status > 0 && job_reads(&jobs[i], keys[k])) {
+                jobs[i].affected = true;
+            }
+        }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (!jobs[i].affected) {
+            continue;
+        }
+        count++;
+
+        for (size_t j = i + 1; j < num_jobs && jobs[j].job.cond != COND_NONE; j++) {
+            jobs[j].affected = true;
+        }
+        if (jobs[i].out_key != NULL) {
+            for (size_t j = i + 1; j < num_jobs; j++) {
+                if (job_reads(&jobs[j], jobs[i].out_key)) {
+                    jobs[j].affected = true;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// True if a change to key matters: the script, or a file a job reads.
+// Anything else in a watched directory is ignored as soon as it is read.
+static bool
+is_watched_key(const char *key)
+{
+    if (script_key != NULL && strcmp(script_key, key) == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (job_reads(&jobs[i], key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add key to changes unless it is already there; takes ownership of key.
+static void
+add_change(change_set_t *changes, char *key)
+{
+    for (size_t i = 0; i < changes->num; i++) {
+        if (strcmp(changes->keys[i], key) == 0) {
+            free(key);
+            return;
+        }
+    }
+    if (changes->num == changes->cap) {
+        size_t cap = changes->cap ? changes->cap * 2 : 16;
+        char **grown = realloc(changes->keys, cap * sizeof(*grown));
+        if (grown == NULL) {
+            perror("realloc");
+            free(key);
+            return;
+        }
+        changes->keys = grown;
+        changes->cap = cap;
+    }
+    changes->keys[changes->num++] = key;
+}
+
+static void
+clear_changes(change_set_t *changes)
+{
+    for (size_t i = 0; i < changes->num; i++) {
+        free(changes->keys[i]);
+    }
+    changes->num = 0;
+}
+
+// Read the events available on the inotify fd, adding the keys that
+// matter to changes. Returns 1 if there were any events, 0 if not, -1 on
+// error.
+static int
+collect_changes(change_set_t *changes)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t n = read(inotify_fd, buf, sizeof(buf));
+    if (n < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+
+    for (char *p = buf; p < buf + n; ) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        p += sizeof(*ev) + ev->len;
+        if (ev->len == 0) {
+            continue;
+        }
+
+        const char *dir = NULL;
+        for (size_t i = 0; i < num_dirs; i++) {
+            if (dirs[i].wd == ev->wd) {
+                dir = dirs[i].dir;
+                break;
+            }
+        }
+        if (dir == NULL) {
+            continue;
+        }
+
+        size_t len = strlen(dir) + 1 + strlen(ev->name) + 1;
+        char *key = malloc(len);
+        if (key == NULL) {
+            continue;
+        }
+        snprintf(key, len, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, ev->name);
+        if (is_watched_key(key)) {
+            add_change(changes, key);
+        } else {
+            free(key);
+        }
+    }
+    return n > 0 ? 1 : 0;
+}
+
+static bool
+written_by_last_pass(const char *key)
+{
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].ran && jobs[i].out_key != NULL && strcmp(jobs[i].out_key, key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Collect the changes made while a pass ran. Those to files the pass wrote
+// itself are dropped, or every pass would trigger the next one; an input
+// edited meanwhile is kept, so it is acted on next.
+static void
+collect_changes_during_pass(change_set_t *changes)
+{
+    int flags = fcntl(inotify_fd, F_GETFL);
+    fcntl(inotify_fd, F_SETFL, flags | O_NONBLOCK);
+    while (collect_changes(changes) > 0) {
+        // read until the queue is empty
+    }
+    fcntl(inotify_fd, F_SETFL, flags);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < changes->num; i++) {
+        if (written_by_last_pass(changes->keys[i])) {
+            free(changes->keys[i]);
+        } else {
+            changes->keys[kept++] = changes->keys[i];
+        }
+    }
+    changes->num = kept;
+}
+
+int
+watch_affected(const char *script, const char *file, bool *affected, size_t max)
+{
+    bool own_fd = inotify_fd < 0;
+    if (own_fd) {
+        inotify_fd = inotify_init1(IN_CLOEXEC);  // load_script() adds watches
+    }
+    char *key = path_key(file);
+    int count = -1;
+    if (key != NULL && load_script(script) == 0) {
+        count = (int)mark_affected(&key, 1);
+        for (size_t i = 0; i < max; i++) {
+            affected[i] = i < num_jobs && jobs[i].affected;
+        }
+    }
+    unload_script();
+    free(key);
+    if (own_fd && inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    return count;
+}
+
+int
+watch_script(const char *path)
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        perror("inotify_init1");
+        return EXIT_FAILURE;
+    }
+
+    if (load_script(path) < 0) {
+        return EXIT_FAILURE;
+    }
+    change_set_t changes = { NULL, 0, 0 };
+    run_jobs(true);
+    collect_changes_during_pass(&changes);
+
+    while (true) {
+        // Block for the first event unless the last pass left some, then
+        // gather a burst of them. Events for files nothing reads don't
+        // wake a pass.
+        while (changes.num == 0) {
+            if (collect_changes(&changes) < 0) {
+                break;
+            }
+        }
+        if (changes.num == 0) {
+            perror("inotify");
+            break;
+        }
+        struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+        while (poll(&pfd, 1, DEBOUNCE_MS) > 0) {
+            if (collect_changes(&changes) < 0) {
+                break;
+            }
+        }
+
+        bool script_changed = false;
+        for (size_t i = 0; i < changes.num; i++) {
+            if (script_key != NULL && strcmp(changes.keys[i], script_key) == 0) {
+                script_changed = true;
+            }
+        }
+
+        if (script_changed) {
+            fprintf(stderr, "mysh: watch: %s changed, running it again\n", path);
+            unload_script();
+            if (load_script(path) == 0) {
+                resume_with_status(0);
+                run_jobs(true);
+            }
+        } else {
+            size_t count = mark_affected(changes.keys, changes.num);
+            if (count > 0) {
+                fprintf(stderr, "mysh: watch: re-running %zu job(s)\n", count);
+                run_jobs(false);
+            }
+        }
+
+        clear_changes(&changes);
+        collect_changes_during_pass(&changes);
+    }
+
+    clear_changes(&changes);
+    free(changes.keys);
+
+    unload_script();
+    close(inotify_fd);
+    return EXIT_FAILURE;
+}
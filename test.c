@@ -3,6 +3,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 // Utility helpers
 
@@ -182,6 +187,22 @@ static void test_parse_redirs_order_flipped(void) {
     printf("\n");
 }
 
+static void test_parse_atomic_redir(void) {
+    printf("=== test_parse_atomic_redir ===\n");
+    job_t job = (job_t){0};
+    char line[] = "sort a >!sorted.txt";
+    int r = parse_line(line, &job);
+    printf("  parse returned %d (expected 1)\n", r);
+    printf("  outfile=%s atomic=%d (expected 'sorted.txt' 1)\n",
+           job.outfile, job.atomic_out);
+    free_job(&job);
+
+    char plain[] = "sort a > sorted.txt";
+    parse_line(plain, &job);
+    printf("  plain '>' atomic=%d (expected 0)\n\n", job.atomic_out);
+    free_job(&job);
+}
+
 // Multiple input redirections should be rejected.
 static void test_parse_multiple_input_redirs(void) {
     printf("=== test_parse_multiple_input_redirs ===\n");
@@ -223,6 +244,156 @@ static void test_parse_conditional_flags(void) {
     printf("\n");
 }
 
+static void test_parse_job_annotations(void) {
+    printf("=== test_parse_job_annotations ===\n");
+    job_t job = (job_t){0};
+    char line1[] = "and @io cp a b";
+    int r1 = parse_line(line1, &job);
+    printf("  'and @io cp a b' parse=%d, cond=%d, jclass=%d (expected 1, %d, JOB_CLASS_IO=%d)\n",
+           r1, job.cond, job.jclass, COND_AND, JOB_CLASS_IO);
+    if (r1 == 1 && strcmp(job.argvv[0][0], "cp") != 0) {
+        printf("  FAIL: argvv[0][0] expected 'cp'\n");
+    }
+    free_job(&job);
+
+    char line2[] = "@gpu echo hi";
+    int r2 = parse_line(line2, &job);
+    printf("  '@gpu echo hi' returned %d (expected -1)\n", r2);
+    free_job(&job);
+
+    char line3[] = "@in=a.txt @cpu @in=b.txt sort";
+    int r3 = parse_line(line3, &job);
+    printf("  '@in=a.txt @cpu @in=b.txt sort' parse=%d, jclass=%d (expected 1, JOB_CLASS_CPU=%d)\n",
+           r3, job.jclass, JOB_CLASS_CPU);
+    if (r3 != 1 || !job.inputs || !job.inputs[0] || !job.inputs[1] ||
+        strcmp(job.inputs[0], "a.txt") != 0 || strcmp(job.inputs[1], "b.txt") != 0 ||
+        job.inputs[2] != NULL) {
+        printf("  FAIL: expected inputs a.txt, b.txt\n");
+    }
+    free_job(&job);
+
+    printf("\n");
+}
+
+// parse_line() on line; its error message, if any, goes into buf.
+static int parse_capturing_error(char *line, char *buf, size_t size) {
+    buf[0] = '\0';
+    int p[2];
+    int saved = dup(STDERR_FILENO);
+    if (saved < 0 || pipe(p) < 0) {
+        return -2;
+    }
+    fflush(stderr);
+    dup2(p[1], STDERR_FILENO);
+    close(p[1]);
+    job_t job = (job_t){0};
+    int r = parse_line(line, &job);
+    free_job(&job);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);  // closes the pipe's last write end
+    close(saved);
+    ssize_t n = read(p[0], buf, size - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    close(p[0]);
+    return r;
+}
+
+// A prefix with no command after it is reported as that prefix.
+static void test_parse_prefix_only(void) {
+    printf("=== test_parse_prefix_only ===\n");
+    char line1[] = "@io", line2[] = "bench -n 3", line3[] = "perfstat",
+         line4[] = "and @in=x", line5[] = "or";
+    char *lines[] = { line1, line2, line3, line4, line5 };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        char shown[64], err[128];
+        snprintf(shown, sizeof(shown), "%s", lines[i]);
+        int r = parse_capturing_error(lines[i], err, sizeof(err));
+        printf("  '%s' returned %d: %s\n", shown, r, err);
+    }
+    printf("  (expected -1 each: '@io', 'bench', 'perfstat', '@in=x' must be "
+           "followed by a command; conditional must be followed by a command)\n\n");
+}
+
+static void test_parse_bench_prefix(void) {
+    printf("=== test_parse_bench_prefix ===\n");
+    job_t job = (job_t){0};
+    char line1[] = "bench -n 3 -w 0 echo hi | wc -c";
+    int r1 = parse_line(line1, &job);
+    printf("  parse=%d, runs=%zu, warmup=%zu, num_procs=%zu (expected 1, 3, 0, 2)\n",
+           r1, job.bench_runs, job.bench_warmup, job.num_procs);
+    free_job(&job);
+
+    char line2[] = "bench echo hi";
+    int r2 = parse_line(line2, &job);
+    printf("  defaults: parse=%d, runs=%zu, warmup=%zu (expected 1, %d, %d)\n",
+           r2, job.bench_runs, job.bench_warmup,
+           BENCH_DEFAULT_RUNS, BENCH_DEFAULT_WARMUP);
+    free_job(&job);
+
+    char line3[] = "bench -n 0 echo hi";
+    int r3 = parse_line(line3, &job);
+    printf("  'bench -n 0' returned %d (expected -1)\n", r3);
+    free_job(&job);
+
+    char line4[] = "and perfstat @cpu sort a | uniq";
+    int r4 = parse_line(line4, &job);
+    printf("  perfstat: parse=%d, perfstat=%d, num_procs=%zu, argv0=%s "
+           "(expected 1, 1, 2, sort)\n\n",
+           r4, job.perfstat, job.num_procs, r4 > 0 ? job.argvv[0][0] : "(none)");
+    free_job(&job);
+}
+
+static void test_parse_chain(void) {
+    printf("=== test_parse_chain ===\n");
+    chain_t chain = (chain_t){0};
+    char line1[] = "echo a ; false && echo b || echo c ;";
+    int r1 = parse_chain(line1, &chain);
+    printf("  parse=%d, num_jobs=%zu (expected 1, 4)\n", r1, chain.num_jobs);
+    if (r1 > 0) {
+        printf("  conds=%d,%d,%d,%d (expected 0,%d,%d,%d)\n",
+               chain.jobs[0].cond, chain.jobs[1].cond, chain.jobs[2].cond,
+               chain.jobs[3].cond, COND_NONE, COND_AND, COND_OR);
+        printf("  texts='%s','%s' (expected 'echo a','false')\n",
+               chain.texts[0], chain.texts[1]);
+    }
+    free_chain(&chain);
+
+    char line2[] = "echo a && or echo b";
+    printf("  '&& or' parse=%d (expected -1)\n", parse_chain(line2, &chain));
+    char line3[] = "echo a ||";
+    printf("  trailing '||' parse=%d (expected -1)\n", parse_chain(line3, &chain));
+    char line4[] = "echo a ; ; echo b";
+    printf("  empty job parse=%d (expected -1)\n", parse_chain(line4, &chain));
+    char line5[] = "# only ; a comment";
+    printf("  comment parse=%d (expected 0)\n\n", parse_chain(line5, &chain));
+}
+
+static void test_parse_interned_tokens(void) {
+    printf("=== test_parse_interned_tokens ===\n");
+    job_t a = (job_t){0}, b = (job_t){0};
+    char line1[] = "grep -v x < in.txt";
+    char line2[] = "grep -c y < in.txt";
+    int r1 = parse_line(line1, &a);
+    int r2 = parse_line(line2, &b);
+    if (r1 > 0 && r2 > 0) {
+        printf("  argv[0] shared=%d, infile shared=%d (expected 1, 1)\n",
+               a.argvv[0][0] == b.argvv[0][0], a.infile == b.infile);
+    }
+    free_job(&a);
+    free_job(&b);
+
+    char line3[] = "exit";
+    r1 = parse_line(line3, &a);
+    char exit_copy[] = "exit";
+    printf("  parsed exit is word=%d, plain copy is word=%d, is_builtin=%d "
+           "(expected 1, 1, 1)\n",
+           r1 > 0 && a.argvv[0][0] == intern_word(WORD_EXIT),
+           is_word(exit_copy, WORD_EXIT), is_builtin(exit_copy));
+    free_job(&a);
+    printf("\n");
+}
+
 // Execution tests (execute_job in mysh_cmds.c)
 
 static void test_exec_echo() {
@@ -323,6 +494,128 @@ static void test_exec_pipeline() {
     free_job_allocated_by_us(&job);
 }
 
+// Native generators: accepted argument forms, output, early reader exit.
+static void test_exec_native_generator(void) {
+    printf("=== test_exec_native_generator ===\n");
+
+    char *seq[] = { "seq", "3", "-1", "1", NULL };
+    char *seq_float[] = { "seq", "1.5", "3", NULL };
+    char *yes[] = { "yes", "ok", NULL };
+    printf("  native seq/seq float/yes=%d,%d,%d (expected 1,0,1)\n",
+           is_native_generator(seq), is_native_generator(seq_float),
+           is_native_generator(yes));
+
+    int p[2];
+    char buf[32] = "";
+    char **seq_stage[] = { seq };
+    if (pipe(p) == 0) {
+        int st = run_native_stages(seq_stage, 1, p[1]);
+        close(p[1]);
+        ssize_t n = read(p[0], buf, sizeof(buf) - 1);
+        buf[n > 0 ? n : 0] = '\0';
+        close(p[0]);
+        printf("  seq status=%d output=%s (expected 0 3,2,1)\n", st,
+               strcmp(buf, "3\n2\n1\n") == 0 ? "3,2,1" : buf);
+    }
+
+    // A step that would overflow ends the sequence, however near last is.
+    char *seq_big[] = { "seq", "-9223372036854775807", "9223372036854775807",
+                        "-9223372036854775806", NULL };
+    char **seq_big_stage[] = { seq_big };
+    if (pipe(p) == 0) {
+        int st = run_native_stages(seq_big_stage, 1, p[1]);
+        close(p[1]);
+        ssize_t n = read(p[0], buf, sizeof(buf) - 1);
+        buf[n > 0 ? n : 0] = '\0';
+        close(p[0]);
+        printf("  seq near LLONG_MIN status=%d lines=%d (expected 0 1)\n", st,
+               strcmp(buf, "-9223372036854775807\n") == 0 ? 1 : -1);
+    }
+
+    // A reader that is already gone must end 'yes', not the shell.
+    char **yes_stage[] = { yes };
+    if (pipe(p) == 0) {
+        close(p[0]);
+        int st = run_native_stages(yes_stage, 1, p[1]);
+        close(p[1]);
+        printf("  yes into closed pipe status=%d (expected 0)\n", st);
+    }
+
+    // Fused: 'yes ok | head -n 3 | wc -l' never leaves the shell.
+    char *head[] = { "head", "-n", "3", NULL };
+    char *wc[] = { "wc", "-l", NULL };
+    char **fused[] = { yes, head, wc };
+    if (pipe(p) == 0) {
+        int st = run_native_stages(fused, 3, p[1]);
+        close(p[1]);
+        ssize_t n = read(p[0], buf, sizeof(buf) - 1);
+        buf[n > 0 ? n : 0] = '\0';
+        close(p[0]);
+        printf("  fused yes|head|wc status=%d output=%s (expected 0 3)\n\n", st,
+               strcmp(buf, "3\n") == 0 ? "3" : buf);
+    }
+}
+
+// Native filter coroutine: head on a pipe, run by native_wait().
+static void test_exec_native_filter(void) {
+    printf("=== test_exec_native_filter ===\n");
+
+    char *head[] = { "head", "-n", "2", NULL };
+    char *wc_file[] = { "wc", "-l", "file.txt", NULL };
+    printf("  native head/wc with file=%d,%d (expected 1,0)\n",
+           is_native_filter(head), is_native_filter(wc_file));
+
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        return;
+    }
+    if (write(in[1], "a\nb\nc\n", 6) != 6) {
+        perror("write");
+    }
+    close(in[1]);
+
+    // Two fused stages: 'cat | head -n 2' as one coroutine.
+    char *cat[] = { "cat", NULL };
+    char **stages[] = { cat, head };
+    pid_t co = native_filter_start(stages, 2, in[0], out[1], true);
+    int wstatus = -1;
+    pid_t done = native_wait(co, &wstatus, NULL);
+
+    char buf[16] = "";
+    ssize_t n = read(out[0], buf, sizeof(buf) - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    close(out[0]);
+    printf("  pseudo pid < -1=%d waited=%d status=%d (expected 1 1 0)\n",
+           co < -1, done == co, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1);
+    printf("  output=%s (expected a,b)\n\n", strcmp(buf, "a\nb\n") == 0 ? "a,b" : buf);
+}
+
+static void test_exec_chain(void) {
+    printf("=== test_exec_chain ===\n");
+    // The last one is fed from 'yes' by the shell, so its stages after
+    // grep must not wait for the event loop.
+    const char *lines[] = { "false && true", "false || true", "true ; false",
+                            "yes y | grep y | head -n 1 | grep -q y" };
+    const int expected[] = { 1, 0, 1, 0 };
+
+    for (int i = 0; i < 4; i++) {
+        char line[64];
+        strcpy(line, lines[i]);
+        chain_t chain = (chain_t){0};
+        pid_t pid = -1;
+        int wstatus = 0;
+        if (parse_chain(line, &chain) > 0 &&
+            launch_chain(&chain, 0, false, &pid) == 0) {
+            waitpid(pid, &wstatus, 0);
+        }
+        printf("  '%s' status=%d (expected %d)\n", lines[i],
+               WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1, expected[i]);
+        free_chain(&chain);
+    }
+    printf("\n");
+}
+
 static void test_exec_exit(void) {
     printf("=== test_exec_exit ===\n");
     job_t job;
@@ -402,33 +695,811 @@ static void test_exec_which_missing(void) {
     free_job_allocated_by_us(&job);
 }
 
+// waitfor: present file, timeout, and a file written or linked by another process.
+static void test_exec_waitfor(void) {
+    printf("=== test_exec_waitfor ===\n");
+
+    job_t job;
+    int st1 = -1, st2 = -1, st3 = -1;
+    unlink("test_waitfor.txt");
+
+    char *present[] = { "waitfor", "test.c", NULL };
+    init_single(&job, present, NULL, NULL);
+    execute_job(&job, true, &st1);
+    free_job_allocated_by_us(&job);
+
+    char *missing[] = { "waitfor", "test_waitfor.txt", "0.1", NULL };
+    init_single(&job, missing, NULL, NULL);
+    execute_job(&job, true, &st2);
+    free_job_allocated_by_us(&job);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", "sleep 0.1; echo done > test_waitfor.txt", (char *)NULL);
+        _exit(127);
+    }
+    char *later[] = { "waitfor", "test_waitfor.txt", "5", NULL };
+    init_single(&job, later, NULL, NULL);
+    execute_job(&job, true, &st3);
+    free_job_allocated_by_us(&job);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+
+    // A symlink is never written through its name, so its creation is enough.
+    int st4 = -1;
+    unlink("test_waitfor.txt");
+    pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", "sleep 0.1; ln -s test.c test_waitfor.txt", (char *)NULL);
+        _exit(127);
+    }
+    char *linked[] = { "waitfor", "test_waitfor.txt", "2", NULL };
+    init_single(&job, linked, NULL, NULL);
+    execute_job(&job, true, &st4);
+    free_job_allocated_by_us(&job);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+    unlink("test_waitfor.txt");
+
+    printf("  present=%d timeout=%d written later=%d symlinked later=%d "
+           "(expected 0,1,0,0)\n\n", st1, st2, st3, st4);
+}
+
+static void test_exec_bench(void) {
+    printf("=== test_exec_bench ===\n");
+
+    job_t job;
+    char *av[] = { "/bin/true", NULL };
+    init_single(&job, av, NULL, NULL);
+    job.bench_runs = 3;
+    job.bench_warmup = 1;
+
+    int st = -1;
+    exec_action_t act = execute_job(&job, true, &st);
+    printf("  action=%d (expected %d=EXEC_CONTINUE)\n", act, EXEC_CONTINUE);
+    printf("  status=%d (expected 0)\n", st);
+    printf("  output: expected three 'bench:' lines on stderr for 3 runs\n\n");
+
+    free_job_allocated_by_us(&job);
+}
+
+static void test_exec_perfstat(void) {
+    printf("=== test_exec_perfstat ===\n");
+
+    job_t job;
+    char *av[] = { "/bin/sh", "-c", "exit 3", NULL };
+    init_single(&job, av, NULL, NULL);
+    job.perfstat = true;
+
+    int st = -1;
+    exec_action_t act = execute_job(&job, true, &st);
+    printf("  action=%d (expected %d=EXEC_CONTINUE)\n", act, EXEC_CONTINUE);
+    printf("  status=%d (expected 3)\n", st);
+    printf("  output: expected a 'perfstat: stage 0 (/bin/sh)' line on stderr,\n"
+           "          or 'perf events unavailable' where perf is not permitted\n\n");
+
+    free_job_allocated_by_us(&job);
+}
+
+// '>!' keeps the old file when the job fails and replaces it on success.
+static void test_exec_atomic_outfile(void) {
+    printf("=== test_exec_atomic_outfile ===\n");
+
+    FILE *f = fopen("test_atomic.txt", "w");
+    if (f == NULL) {
+        perror("test_atomic.txt");
+        return;
+    }
+    fputs("old\n", f);
+    fclose(f);
+
+    job_t job;
+    int st = -1;
+    char *fail[] = { "ls", "/nonexistent_dir_for_atomic_test", NULL };
+    init_single(&job, fail, NULL, "test_atomic.txt");
+    job.atomic_out = true;
+    execute_job(&job, true, &st);
+    free_job_allocated_by_us(&job);
+
+    char buf[32] = "";
+    f = fopen("test_atomic.txt", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+        fclose(f);
+    }
+    printf("  after failure: status=%d content=%s (expected != 0, 'old')\n",
+           st, strtok(buf, "\n") ? buf : "(empty)");
+
+    char *ok[] = { "echo", "new", NULL };
+    init_single(&job, ok, NULL, "test_atomic.txt");
+    job.atomic_out = true;
+    execute_job(&job, true, &st);
+    free_job_allocated_by_us(&job);
+
+    buf[0] = '\0';
+    f = fopen("test_atomic.txt", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+        fclose(f);
+    }
+    printf("  after success: status=%d content=%s (expected 0, 'new')\n\n",
+           st, strtok(buf, "\n") ? buf : "(empty)");
+}
+
+// "> @shm:NAME" then "< @shm:NAME": the ring hands the output back.
+static void test_exec_shm_ring(void) {
+    printf("=== test_exec_shm_ring ===\n");
+
+    job_t job;
+    int st1 = -1, st2 = -1;
+    unlink("/dev/shm/mysh.mysh_test");
+
+    char *producer[] = { "echo", "through", "the", "ring", NULL };
+    init_single(&job, producer, NULL, "@shm:mysh_test");
+    execute_job(&job, true, &st1);
+    free_job_allocated_by_us(&job);
+
+    char *consumer[] = { "wc", "-w", NULL };
+    init_single(&job, consumer, "@shm:mysh_test", "test_shm.txt");
+    execute_job(&job, true, &st2);
+    free_job_allocated_by_us(&job);
+
+    char buf[32] = "";
+    FILE *f = fopen("test_shm.txt", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+        fclose(f);
+    }
+    printf("  statuses=%d,%d (expected 0,0)\n", st1, st2);
+    printf("  words read back=%s (expected 3)\n\n", strtok(buf, "\n") ? buf : "(none)");
+    unlink("/dev/shm/mysh.mysh_test");
+}
+
+// coproc builtin: start a helper, feed it through @co:NAME, stop it.
+static void test_exec_coproc(void) {
+    printf("=== test_exec_coproc ===\n");
+
+    job_t job;
+    int st = -1;
+
+    char *start[] = { "coproc", "t", "cat", NULL };
+    init_single(&job, start, NULL, NULL);
+    execute_job(&job, true, &st);
+    printf("  start status=%d (expected 0)\n", st);
+    free_job_allocated_by_us(&job);
+
+    char *feed[] = { "echo", "to-coproc", NULL };
+    init_single(&job, feed, NULL, "@co:t");
+    execute_job(&job, true, &st);
+    printf("  echo > @co:t status=%d (expected 0)\n", st);
+    free_job_allocated_by_us(&job);
+
+    char *stop[] = { "coproc", "t", NULL };
+    init_single(&job, stop, NULL, NULL);
+    execute_job(&job, true, &st);
+    printf("  stop status=%d (expected 0)\n", st);
+    free_job_allocated_by_us(&job);
+
+    char *gone[] = { "echo", "x", NULL };
+    init_single(&job, gone, NULL, "@co:t");
+    execute_job(&job, true, &st);
+    printf("  echo > @co:t after stop status=%d (expected != 0)\n", st);
+    free_job_allocated_by_us(&job);
+
+    // Under -j the scheduler's waitpid(-1) may reap the coprocess first.
+    sched_init(2);
+    char *quit[] = { "coproc", "q", "sh", "-c", "exit 3", NULL };
+    init_single(&job, quit, NULL, NULL);
+    execute_job(&job, true, &st);
+    free_job_allocated_by_us(&job);
+    char *nap[] = { "sleep", "0.2", NULL };
+    init_single(&job, nap, NULL, NULL);
+    sched_submit(&job, false);
+    sched_drain();
+    free_job_allocated_by_us(&job);
+    char *stop_q[] = { "coproc", "q", NULL };
+    init_single(&job, stop_q, NULL, NULL);
+    execute_job(&job, true, &st);
+    printf("  stop after the scheduler reaped it status=%d (expected 3)\n\n", st);
+    free_job_allocated_by_us(&job);
+    sched_after_fork();  // back to serial
+}
+
+// Builtin plugins: the example plugin via dlopen, and builtins registered
+// directly to check where each kind runs.
+static int plugin_calls_in_shell = 0;
+
+static int count_input(int argc, char *const argv[], int in_fd, int out_fd,
+                       int err_fd, void *data) {
+    (void)argc; (void)argv; (void)out_fd; (void)err_fd; (void)data;
+    char buf[256];
+    int total = 0;
+    ssize_t n;
+    while ((n = read(in_fd, buf, sizeof(buf))) > 0) {
+        total += (int)n;
+    }
+    __atomic_add_fetch(&plugin_calls_in_shell, 1, __ATOMIC_RELAXED);
+    return total;
+}
+
+static int return_42(int argc, char *const argv[], int in_fd, int out_fd,
+                     int err_fd, void *data) {
+    (void)argc; (void)argv; (void)in_fd; (void)out_fd; (void)err_fd; (void)data;
+    __atomic_add_fetch(&plugin_calls_in_shell, 1, __ATOMIC_RELAXED);
+    return 42;
+}
+
+static void test_exec_plugins(void) {
+    printf("=== test_exec_plugins ===\n");
+    int loaded = plugin_load_dir("plugins");
+    printf("  loaded=%d upcase flags=%u is_builtin=%d (expected 1 7 1)\n",
+           loaded, plugin_flags("upcase"), is_builtin("upcase"));
+
+    mysh_builtin_def_t count = { "tcount", MYSH_BUILTIN_THREAD, count_input, NULL };
+    mysh_builtin_def_t parent = { "tparent", MYSH_BUILTIN_PARENT, return_42, NULL };
+    mysh_builtin_def_t taken = { "cd", MYSH_BUILTIN_CHILD, return_42, NULL };
+    int r1 = plugin_register(&count);
+    int r2 = plugin_register(&parent);
+    int r3 = plugin_register(&taken);
+    int r4 = plugin_register(&count);
+    printf("  register tcount/tparent/cd/tcount again=%d,%d,%d,%d (expected 0,0,-1,-1)\n",
+           r1, r2, r3, r4);
+
+    // On its own, tparent runs in the shell; as the last stage, tcount runs
+    // on a thread in the shell and its status is the job's.
+    const char *lines[] = { "tparent", "echo hello | tcount", "tparent | cat" };
+    const int expected[] = { 42, 6, 0 };
+    for (int i = 0; i < 3; i++) {
+        char line[32];
+        strcpy(line, lines[i]);
+        job_t job = (job_t){0};
+        int st = -1;
+        if (parse_line(line, &job) > 0) {
+            fflush(stdout);
+            execute_job(&job, false, &st);
+        }
+        printf("  '%s' status=%d (expected %d)\n", lines[i], st, expected[i]);
+        free_job(&job);
+    }
+    printf("  calls in the shell=%d (expected 2)\n\n", plugin_calls_in_shell);
+}
+
+// Nested scripts run in the forked child, not by exec'ing mysh: there is
+// no mysh on the search path here, so an exec of "env mysh" would fail.
+static void write_script(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (f != NULL) {
+        fputs(text, f);
+        fclose(f);
+        chmod(path, 0755);
+    }
+}
+
+static void test_exec_nested_script(void) {
+    printf("=== test_exec_nested_script ===\n");
+    write_script("test_nested.mysh", "echo nested > test_nested.txt\nfalse\nor true\n");
+    write_script("test_nested_die", "#!/usr/bin/env mysh\ndie\n");
+    unlink("test_nested.txt");
+
+    char *ext[] = { "./test_nested.mysh", NULL };
+    char *die_script[] = { "./test_nested_die", NULL };
+    char *with_arg[] = { "./test_nested_die", "x", NULL };
+    char *binary[] = { "/bin/true", NULL };
+    printf("  nested: .mysh/env mysh/with arg/binary=%d,%d,%d,%d (expected 1,1,0,0)\n",
+           is_nested_script(ext[0], ext), is_nested_script(die_script[0], die_script),
+           is_nested_script(with_arg[0], with_arg), is_nested_script(binary[0], binary));
+
+    job_t job;
+    int st1 = -1, st2 = -1;
+    init_single(&job, ext, NULL, NULL);
+    fflush(stdout);
+    execute_job(&job, false, &st1);
+    free_job_allocated_by_us(&job);
+    init_single(&job, die_script, NULL, NULL);
+    execute_job(&job, false, &st2);
+    free_job_allocated_by_us(&job);
+
+    char buf[32] = "";
+    FILE *f = fopen("test_nested.txt", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) == NULL) {
+            buf[0] = '\0';
+        }
+        fclose(f);
+    }
+    printf("  .mysh status=%d output=%s die status=%d (expected 0 nested 1)\n\n",
+           st1, strcmp(buf, "nested\n") == 0 ? "nested" : buf, st2);
+}
+
+// Prepared templates (mysh_prepared.c)
+
+static void test_prepared_job(void) {
+    printf("=== test_prepared_job ===\n");
+
+    job_template_t *tmpl = prepare_job("echo prepared $1 $2 | wc -w");
+    printf("  prepare returned %s (expected template)\n", tmpl ? "template" : "NULL");
+    if (tmpl) {
+        int st = -1;
+        char *v1[] = { "one", "two" };
+        execute_prepared(tmpl, v1, 2, true, &st);
+        printf("  run with 2 values status=%d (expected 0, prints 3)\n", st);
+
+        char *v2[] = { "a b", "c" };
+        execute_prepared(tmpl, v2, 2, true, &st);
+        printf("  rerun status=%d (expected 0, prints 4)\n", st);
+
+        execute_prepared(tmpl, v1, 1, true, &st);
+        printf("  missing $2 status=%d (expected != 0)\n", st);
+        free_prepared(tmpl);
+    }
+
+    job_template_t *bad = prepare_job("no_such_command_9999 $1");
+    printf("  unknown command returned %s (expected NULL)\n", bad ? "template" : "NULL");
+    free_prepared(bad);
+
+    bad = prepare_job("and echo hi");
+    printf("  conditional returned %s (expected NULL)\n\n", bad ? "template" : "NULL");
+    free_prepared(bad);
+}
+
+// Watch mode (mysh_watch.c): which jobs a changed file selects.
+
+static void test_watch_affected(void) {
+    printf("=== test_watch_affected ===\n");
+    write_script("test_watch.mysh",
+                 "cat < test_watch_a.txt > test_watch_out.txt\n"
+                 "and echo chained\n"
+                 "cat < test_watch_b.txt\n"
+                 "wc -l < test_watch_out.txt\n");
+
+    bool hit[4];
+    int n = watch_affected("test_watch.mysh", "test_watch_a.txt", hit, 4);
+    printf("  change a: count=%d jobs=%d%d%d%d (expected 3 1101)\n",
+           n, hit[0], hit[1], hit[2], hit[3]);
+    n = watch_affected("test_watch.mysh", "./test_watch_b.txt", hit, 4);
+    printf("  change b: count=%d jobs=%d%d%d%d (expected 1 0010)\n",
+           n, hit[0], hit[1], hit[2], hit[3]);
+    n = watch_affected("test_watch.mysh", "test_watch_other.txt", hit, 4);
+    printf("  unrelated: count=%d jobs=%d%d%d%d (expected 0 0000)\n\n",
+           n, hit[0], hit[1], hit[2], hit[3]);
+}
+
+// Scheduler tests (mysh_sched.c)
+
+static void test_sched_class_rules(void) {
+    printf("=== test_sched_class_rules ===\n");
+
+    job_t job;
+    char *av[] = { "/bin/cp", "a", "b", NULL };
+    init_single(&job, av, NULL, NULL);
+
+    printf("  class before rule=%d (expected %d=JOB_CLASS_NONE)\n",
+           sched_class_of(&job), JOB_CLASS_NONE);
+    sched_add_class_rule(JOB_CLASS_IO, "cp");
+    printf("  class after rule=%d (expected %d=JOB_CLASS_IO)\n",
+           sched_class_of(&job), JOB_CLASS_IO);
+    job.jclass = JOB_CLASS_CPU;
+    printf("  explicit @cpu class=%d (expected %d=JOB_CLASS_CPU)\n\n",
+           sched_class_of(&job), JOB_CLASS_CPU);
+
+    free_job_allocated_by_us(&job);
+}
+
+static void test_sched_adapt_limit(void) {
+    printf("=== test_sched_adapt_limit ===\n");
+
+    sched_init(8);
+    sched_set_adaptive(true);
+    sched_adapt_sample(40.0, 0.5);   // CPU pressure: back off by a quarter
+    size_t high_psi = sched_current_limit();
+    sched_adapt_sample(-1.0, 3.0);   // no PSI, overloaded
+    size_t high_load = sched_current_limit();
+    sched_adapt_sample(15.0, 1.2);   // between the marks: hold
+    size_t held = sched_current_limit();
+    sched_adapt_sample(2.0, 0.2);    // idle: grow by one
+    size_t grown = sched_current_limit();
+    for (int i = 0; i < 10; i++) {
+        sched_adapt_sample(2.0, 0.2);
+    }
+    size_t capped = sched_current_limit();
+    for (int i = 0; i < 10; i++) {
+        sched_adapt_sample(90.0, 9.0);
+    }
+    printf("  limit: %zu %zu %zu %zu %zu %zu (expected 6 5 5 6 8 1)\n\n",
+           high_psi, high_load, held, grown, capped, sched_current_limit());
+
+    sched_after_fork();  // back to serial for the tests after this one
+}
+
+static void read_first_line(const char *path, char *buf, size_t size) {
+    buf[0] = '\0';
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        if (fgets(buf, (int)size, f) == NULL) {
+            buf[0] = '\0';
+        }
+        fclose(f);
+    }
+}
+
+// Runs script under -j 4 and returns the first line of out.
+static void run_concurrent(const char *script, const char *out, char *buf, size_t size) {
+    write_script("test_sched.mysh", script);
+    unlink(out);
+    int fd = open("test_sched.mysh", O_RDONLY);
+    if (fd >= 0) {
+        sched_init(4);
+        read_and_execute_loop(fd);
+        sched_after_fork();  // back to serial
+        close(fd);
+    }
+    read_first_line(out, buf, size);
+}
+
+// A reader waits for the writer of its input however the path is spelled.
+static void test_sched_conflicts(void) {
+    printf("=== test_sched_conflicts ===\n");
+    write_script("test_sched_gen.sh", "#!/bin/sh\nsleep 0.3\necho data\n");
+
+    char buf[32];
+    run_concurrent("./test_sched_gen.sh > test_sched.txt\n"
+                   "cat < ./test_sched.txt > test_sched_copy.txt\n",
+                   "test_sched_copy.txt", buf, sizeof(buf));
+    printf("  ./ spelling of the writer's output=%s (expected data)\n",
+           strcmp(buf, "data\n") == 0 ? "data" : buf);
+
+    // A declared '@in=' input is a read, just like '<'.
+    run_concurrent("./test_sched_gen.sh > test_sched.txt\n"
+                   "@in=test_sched.txt cp test_sched.txt test_sched_copy.txt\n",
+                   "test_sched_copy.txt", buf, sizeof(buf));
+    printf("  @in= input of the writer's output=%s (expected data)\n",
+           strcmp(buf, "data\n") == 0 ? "data" : buf);
+
+    // ...and a later writer of that input waits for its reader.
+    write_script("test_sched_read.sh", "#!/bin/sh\nsleep 0.3\ncat test_sched.txt\n");
+    write_script("test_sched.txt", "old\n");
+    run_concurrent("@in=test_sched.txt ./test_sched_read.sh > test_sched_copy.txt\n"
+                   "echo new > test_sched.txt\n",
+                   "test_sched_copy.txt", buf, sizeof(buf));
+    printf("  reader of an @in= input rewritten later=%s (expected old)\n\n",
+           strcmp(buf, "old\n") == 0 ? "old" : buf);
+}
+
+// --ordered: a slow first job's output still comes first, and no more than
+// MAX_PENDING_SPOOLS (256) finished jobs' spools are held, whatever -j says.
+static void test_sched_ordered(void) {
+    printf("=== test_sched_ordered ===\n");
+    write_script("test_sched_gen.sh", "#!/bin/sh\nsleep 0.3\necho data\n");
+    FILE *f = fopen("test_sched.mysh", "w");
+    if (f == NULL) {
+        perror("test_sched.mysh");
+        return;
+    }
+    fputs("./test_sched_gen.sh\n", f);
+    for (int i = 0; i < 300; i++) {
+        fprintf(f, "echo %d\n", i);
+    }
+    fclose(f);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Two memfds per held job: all 300 jobs behind the slow one would
+        // need 600, more than this allows, unless launches wait at the cap.
+        // An error would land in the output, between the lines.
+        struct rlimit lim = { 600, 600 };
+        setrlimit(RLIMIT_NOFILE, &lim);
+        int out = open("test_sched.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int fd = open("test_sched.mysh", O_RDONLY);
+        if (out < 0 || fd < 0 || dup2(out, STDOUT_FILENO) < 0 ||
+            dup2(out, STDERR_FILENO) < 0 ||
+            sched_init(512) < 0 || sched_set_ordered(true) < 0) {
+            _exit(1);
+        }
+        read_and_execute_loop(fd);
+        _exit(0);
+    }
+    int wstatus = -1;
+    if (pid > 0) {
+        waitpid(pid, &wstatus, 0);
+    }
+
+    int in_order = 0;
+    char line[32], want[32];
+    f = fopen("test_sched.txt", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (in_order == 0) {
+            snprintf(want, sizeof(want), "data\n");
+        } else {
+            snprintf(want, sizeof(want), "%d\n", in_order - 1);
+        }
+        if (strcmp(line, want) != 0) {
+            break;
+        }
+        in_order++;
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    printf("  status=%d lines in script order=%d (expected 0 301)\n\n",
+           WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1, in_order);
+}
+
+// Spool consumer steps (mysh_spool.c)
+
+static bool file_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static void test_spool_claim(void) {
+    printf("=== test_spool_claim ===\n");
+
+    printf("  job names: a.job/.a.job/.job/a.jobs=%d,%d,%d,%d (expected 1,0,0,0)\n",
+           spool_is_job_name("a.job"), spool_is_job_name(".a.job"),
+           spool_is_job_name(".job"), spool_is_job_name("a.jobs"));
+
+    mkdir("test_spool", 0750);
+    int prepared = spool_prepare("test_spool");
+    write_script("test_spool/a.job", "echo a\n");
+    write_script("test_spool/b.job", "echo b\n");
+
+    int won = spool_claim("a.job");
+    printf("  claim status=%d moved=%d (expected 0 1)\n",
+           won, !file_exists("test_spool/a.job") && file_exists("test_spool/claimed/a.job"));
+
+    // Another consumer renames b.job away first; this one loses quietly.
+    rename("test_spool/b.job", "test_spool/claimed/b.job");
+    printf("  lost race status=%d (expected -1)\n", spool_claim("b.job"));
+
+    spool_finish("a.job", 3);
+    char line[16] = "";
+    FILE *f = fopen("test_spool/done/a.job.status", "r");
+    if (f != NULL) {
+        if (fgets(line, sizeof(line), f) == NULL) line[0] = '\0';
+        fclose(f);
+    }
+    printf("  prepare=%d status file=%s job in done=%d (expected 0 3 1)\n\n",
+           prepared, strcmp(line, "3\n") == 0 ? "3" : line,
+           file_exists("test_spool/done/a.job") && !file_exists("test_spool/claimed/a.job"));
+}
+
+// Flight recorder tests (mysh_flight.c)
+
+static void test_flight_dump(void) {
+    printf("=== test_flight_dump ===\n");
+
+    int fd = open("test_flight.bin", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("test_flight.bin");
+        return;
+    }
+    flight_record(FLIGHT_SPAWN, 1234, 2);
+    flight_record(FLIGHT_REAP, 1234, 0);
+    flight_dump_fd(fd);
+    close(fd);
+
+    FILE *tmp = fopen("test_flight.bin", "rb");
+    if (tmp == NULL) {
+        perror("test_flight.bin");
+        return;
+    }
+
+    flight_header_t hdr;
+    static flight_rec_t recs[FLIGHT_CAPACITY];
+    size_t ok = fread(&hdr, sizeof(hdr), 1, tmp);
+    ok += fread(recs, sizeof(recs[0]), FLIGHT_CAPACITY, tmp);
+    fclose(tmp);
+
+    const flight_rec_t *last = &recs[(hdr.next - 1) & (FLIGHT_CAPACITY - 1)];
+    printf("  read %zu items (expected %d)\n", ok, 1 + FLIGHT_CAPACITY);
+    printf("  magic ok=%d (expected 1)\n",
+           memcmp(hdr.magic, FLIGHT_MAGIC, sizeof(hdr.magic)) == 0);
+    printf("  last event=%u pid=%d (expected %d pid=1234)\n",
+           last->event, last->a, FLIGHT_REAP);
+    printf("  last seq matches header=%d (expected 1)\n\n", last->seq == hdr.next);
+}
+
+// Analysis tests (mysh_analyze.c)
+
+static void test_analyze_critical_path(void) {
+    printf("=== test_analyze_critical_path ===\n");
+
+    // 1 and 2 are independent; 3 reads what 1 writes; 4 chains on 3;
+    // cd is a barrier; 6 only follows the barrier.
+    const char *lines[] = {
+        "sort big > out.txt", "sleep 1", "wc < out.txt", "and echo ok",
+        "cd /tmp", "echo done",
+    };
+    const double weights[] = { 4.0, 3.0, 1.0, 1.0, 0.0, 2.0 };
+
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s", lines[i]);
+        job_t job = (job_t){0};
+        if (parse_line(buf, &job) > 0) {
+            analyze_add_job(&job, lines[i], weights[i]);
+        }
+        free_job(&job);
+    }
+
+    double work = 0.0;
+    double span = analyze_critical_path(&work);
+    printf("  critical path=%.1f (expected 8.0)\n", span);
+    printf("  total work=%.1f (expected 11.0)\n\n", work);
+    analyze_reset();
+}
+
+// Progress reporting (mysh_progress.c)
+
+static void test_progress_eta(void) {
+    printf("=== test_progress_eta ===\n");
+
+    // 40 lines of 10 bytes; no history yet.
+    FILE *f = fopen("test_progress.mysh", "w");
+    for (int i = 0; f != NULL && i < 40; i++) {
+        fputs("echo 1234\n", f);
+    }
+    if (f != NULL) fclose(f);
+    unlink("test_progress.mysh.progress");
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    int in = open("test_progress.mysh", O_RDONLY);
+    bool hist = true;
+    progress_init(null_fd, in, "test_progress.mysh");
+    for (int i = 0; i < 10; i++) progress_line(10);
+    double rate_eta = progress_eta(10.0, &hist);
+    printf("  running rate: eta=%.0f history=%d (expected 30 0)\n", rate_eta, hist);
+    for (int i = 10; i < 40; i++) progress_line(10);
+    progress_end(true);
+
+    char line[64] = "";
+    f = fopen("test_progress.mysh.progress", "r");
+    if (f != NULL) {
+        if (fgets(line, sizeof(line), f) == NULL) line[0] = '\0';
+        fclose(f);
+    }
+    printf("  history saved=%d (expected 1)\n",
+           strcmp(line, "mysh-progress 1 400\n") == 0);
+
+    // The last run spent 1s on the first quarter and 100s on the rest;
+    // this one is going at half its pace.
+    f = fopen("test_progress.mysh.progress", "w");
+    if (f != NULL) {
+        fputs("mysh-progress 1 400\n100 1.000\n400 101.000\n", f);
+        fclose(f);
+    }
+    lseek(in, 0, SEEK_SET);
+    progress_init(null_fd, in, "test_progress.mysh");
+    for (int i = 0; i < 10; i++) progress_line(10);
+    double hist_eta = progress_eta(2.0, &hist);
+    printf("  from history: eta=%.0f history=%d (expected 200 1)\n", hist_eta, hist);
+    progress_end(false);
+
+    // A history for another size of script is ignored.
+    f = fopen("test_progress.mysh.progress", "w");
+    if (f != NULL) {
+        fputs("mysh-progress 1 999\n999 50.000\n", f);
+        fclose(f);
+    }
+    lseek(in, 0, SEEK_SET);
+    progress_init(null_fd, in, "test_progress.mysh");
+    for (int i = 0; i < 20; i++) progress_line(10);
+    double stale_eta = progress_eta(4.0, &hist);
+    printf("  stale history: eta=%.0f history=%d (expected 4 0)\n\n", stale_eta, hist);
+    progress_end(false);
+
+    close(in);
+    close(null_fd);
+}
+
 // Main test runner
 
+// Subreaper tests (mysh_reaper.c). This makes the test binary a subreaper,
+// so it runs last.
+
+static void test_reaper_kills_straggler(void) {
+    printf("=== test_reaper_kills_straggler ===\n");
+
+    if (reaper_init(true) < 0) {
+        printf("  subreaper unavailable; skipped\n\n");
+        return;
+    }
+
+    // The shell exits at once, leaving its background sleep to be adopted.
+    job_t job;
+    int st = -1;
+    char *av[] = { "sh", "-c", "sleep 30 &", NULL };
+    init_single(&job, av, NULL, NULL);
+    unsigned id = reaper_job_started(&job);
+    execute_job(&job, true, &st);
+    reaper_job_finished(id);
+    free_job_allocated_by_us(&job);
+
+    char line[256] = "";
+    FILE *out = tmpfile();
+    if (out != NULL) {
+        reaper_report(out);
+        rewind(out);
+        if (fgets(line, sizeof(line), out) == NULL) line[0] = '\0';
+        fclose(out);
+    }
+    printf("  job id=%u status=%d (expected 1 0)\n", id, st);
+    printf("  reaped and killed=%d (expected 1)\n\n",
+           strstr(line, "1 orphan reaped") != NULL && strstr(line, "1 killed") != NULL);
+}
+
 int main(void) {
     printf("======== PARSE TESTS ========\n");
     test_parse_simple();
     test_parse_pipeline();
     test_parse_redirs();
     test_parse_redirs_order_flipped();
+    test_parse_atomic_redir();
     test_parse_multiple_input_redirs();
     test_parse_redir_missing_filename();
     test_parse_comment_only();
     test_parse_trailing_comment();
     test_parse_conditional_errors();
     test_parse_conditional_flags();
+    test_parse_job_annotations();
+    test_parse_bench_prefix();
+    test_parse_prefix_only();
+    test_parse_chain();
+    test_parse_interned_tokens();
 
     printf("======== EXEC TESTS ========\n");
     test_exec_echo();
     test_exec_ls_outfile();
+    test_exec_atomic_outfile();
+    test_exec_shm_ring();
     test_exec_pwd_builtin();
     test_exec_die();
     test_exec_missing_cmd();
     test_exec_pipeline();
+    test_exec_native_generator();
+    test_exec_native_filter();
+    test_exec_chain();
     test_exec_exit();
     test_batch_stdin_null();
     test_exec_which_external();
     test_exec_which_builtin();
     test_exec_which_missing();
+    test_exec_waitfor();
+    test_exec_coproc();
+    test_exec_plugins();
+    test_exec_nested_script();
+    test_exec_bench();
+    test_exec_perfstat();
+
+    printf("======== PREPARED TESTS ========\n");
+    test_prepared_job();
+
+    printf("======== WATCH TESTS ========\n");
+    test_watch_affected();
+
+    printf("======== SCHED TESTS ========\n");
+    test_sched_class_rules();
+    test_sched_adapt_limit();
+    test_sched_conflicts();
+    test_sched_ordered();
+
+    printf("======== SPOOL TESTS ========\n");
+    test_spool_claim();
+
+    printf("======== FLIGHT TESTS ========\n");
+    test_flight_dump();
+
+    printf("======== ANALYZE TESTS ========\n");
+    test_analyze_critical_path();
+
+    printf("======== PROGRESS TESTS ========\n");
+    test_progress_eta();
+
+    printf("======== REAPER TESTS ========\n");
+    test_reaper_kills_straggler();
 
     return 0;
 }
@@ -0,0 +1,3 @@
+#!/bin/sh
+sleep 0.3
+cat test_sched.txt
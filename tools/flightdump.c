@@ -0,0 +1,113 @@
+// Decoder for mysh flight recorder dumps.
+//
+// Usage: flightdump FILE
+//
+// Prints the surviving events oldest first, one per line:
+//   +SECONDS  PID  EVENT  DETAILS
+// where SECONDS is relative to the oldest event in the dump. Slots that
+// were never written, or were being overwritten when the dump was taken,
+// are skipped.
+
+#define _GNU_SOURCE
+
+#include "mysh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static flight_rec_t recs[FLIGHT_CAPACITY];
+
+static int
+compare_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const flight_rec_t *)a)->seq;
+    uint64_t y = ((const flight_rec_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+static void
+print_rec(const flight_rec_t *rec, uint64_t base_ns)
+{
+    printf("+%.6f %7d  ", (double)(rec->ns - base_ns) / 1e9, rec->pid);
+
+    switch (rec->event) {
+    case FLIGHT_PARSE:
+        printf("parse     status=%d stages=%d\n", rec->a, rec->b);
+        break;
+    case FLIGHT_SPAWN:
+        printf("spawn     pid=%d stage=%d\n", rec->a, rec->b);
+        break;
+    case FLIGHT_REAP:
+        printf("reap      pid=%d wstatus=0x%x\n", rec->a, (unsigned)rec->b);
+        break;
+    case FLIGHT_REDIRECT:
+        if (rec->a < 0) {
+            printf("redirect  %s failed: %s\n", rec->b ? ">" : "<", strerror(-rec->a));
+        } else {
+            printf("redirect  %s fd=%d\n", rec->b ? ">" : "<", rec->a);
+        }
+        break;
+    case FLIGHT_COND_SKIP:
+        printf("skip      %s (last status %d)\n",
+               rec->a == COND_AND ? "and" : "or", rec->b);
+        break;
+    case FLIGHT_DIE:
+        printf("die       exit=%d\n", rec->a);
+        break;
+    case FLIGHT_SIGNAL:
+        printf("signal    %s%s\n", strsignal(rec->a), rec->b ? " (fatal)" : "");
+        break;
+    default:
+        printf("event %u  a=%d b=%d\n", rec->event, rec->a, rec->b);
+        break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    flight_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, FLIGHT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.capacity != FLIGHT_CAPACITY || hdr.rec_size != sizeof(flight_rec_t)) {
+        fprintf(stderr, "%s: not a mysh flight recorder dump (or another version)\n",
+                argv[1]);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    size_t n = fread(recs, sizeof(recs[0]), FLIGHT_CAPACITY, f);
+    fclose(f);
+
+    // Keep only slots holding one of the last `capacity` events. The dump
+    // writes seq 0 for a slot that was being written while it was copied
+    // (see flight_dump_fd()), and any other seq must belong to the slot's
+    // position; anything else is not a whole record.
+    uint64_t oldest = hdr.next > FLIGHT_CAPACITY ? hdr.next - FLIGHT_CAPACITY : 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t seq = recs[i].seq;
+        if (seq != 0 && seq > oldest && seq <= hdr.next &&
+            ((seq - 1) & (FLIGHT_CAPACITY - 1)) == i) {
+            recs[kept++] = recs[i];
+        }
+    }
+    qsort(recs, kept, sizeof(recs[0]), compare_seq);
+
+    printf("mysh flight recorder: pid %d, %llu events recorded, %zu shown\n",
+           hdr.pid, (unsigned long long)hdr.next, kept);
+    for (size_t i = 0; i < kept; i++) {
+        print_rec(&recs[i], recs[0].ns);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// Example mysh builtin plugin (see mysh_plugin.h).
+//
+// Build: make plugins/upcase.so, then run mysh --plugins plugins.
+//
+// upcase [WORD...]
+//   With words, prints them upper-cased on one line; otherwise copies its
+//   input to its output upper-cased. It only uses its fds and the stack, so
+//   it may run anywhere: in the shell, in a child, or on a thread.
+
+#define _GNU_SOURCE
+
+#include "mysh_plugin.h"
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// Write all of buf; -1 once the reader is gone or the write fails.
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void
+upcase_buffer(char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (char)toupper((unsigned char)buf[i]);
+    }
+}
+
+static int
+upcase_run(int argc, char *const argv[], int in_fd, int out_fd, int err_fd,
+           void *data)
+{
+    (void)err_fd;
+    (void)data;
+    char buf[65536];
+
+    if (argc > 1) {
+        size_t len = 0;
+        for (int i = 1; i < argc; i++) {
+            size_t word = strlen(argv[i]);
+            if (len + word + 1 > sizeof(buf)) {
+                word = sizeof(buf) - len - 1;
+            }
+            memcpy(buf + len, argv[i], word);
+            len += word;
+            buf[len++] = (i + 1 < argc) ? ' ' : '\n';
+            if (len == sizeof(buf)) {
+                break;
+            }
+        }
+        upcase_buffer(buf, len);
+        return (write_all(out_fd, buf, len) < 0 && errno != EPIPE) ? 1 : 0;
+    }
+
+    while (1) {
+        ssize_t n = read(in_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        upcase_buffer(buf, (size_t)n);
+        if (write_all(out_fd, buf, (size_t)n) < 0) {
+            return errno == EPIPE ? 0 : 1;  // a reader that left early is fine
+        }
+    }
+}
+
+int
+mysh_plugin_init(const mysh_plugin_api_t *api)
+{
+    if (api->abi_version != MYSH_PLUGIN_ABI_VERSION) {
+        return -1;
+    }
+    mysh_builtin_def_t def = {
+        .name  = "upcase",
+        .flags = MYSH_BUILTIN_PARENT | MYSH_BUILTIN_CHILD | MYSH_BUILTIN_THREAD,
+        .run   = upcase_run,
+        .data  = NULL,
+    };
+    return api->register_builtin(&def);
+}